@@ -14,6 +14,10 @@ void DirectionalLight::Initialize(ID3D11Device* pDevice, const Vector3& dir, flo
     m_Color = col;
     m_Intensity = intensity;
 
+#if defined(SOFTWARE_ONLY)
+    // Null GPU backend, no shadow map resources
+    (void)pDevice;
+#else
     // 2.
     // Create Effect
     m_pEffect = new Effect(pDevice, L"resources/LightMap.fx");
@@ -109,15 +113,18 @@ void DirectionalLight::Initialize(ID3D11Device* pDevice, const Vector3& dir, flo
 
     if (FAILED(result))
         assert(false);
+#endif
 }
 DirectionalLight::~DirectionalLight()
 {
+#if !defined(SOFTWARE_ONLY)
     if (m_pInputLayout)         m_pInputLayout->Release();
     if (m_pShadowMapSRV)        m_pShadowMapSRV->Release();
     if (m_pShadowMapDSV)        m_pShadowMapDSV->Release();
     if (m_pShadowMapTexture)    m_pShadowMapTexture->Release();
 
     delete m_pEffect;
+#endif
 }
 
 
@@ -155,6 +162,10 @@ void DirectionalLight::UpdateViewProjection(const Vector3& target, const Vector3
 }
 void DirectionalLight::RenderShadowMap(ID3D11DeviceContext* pDeviceContext, const std::map<const std::string, Mesh*>& meshes) const
 {
+#if defined(SOFTWARE_ONLY)
+    (void)pDeviceContext;
+    (void)meshes;
+#else
     // 1.
     // Set Render Target to the Shadow Map
 	pDeviceContext->OMSetRenderTargets(0, nullptr, m_pShadowMapDSV);
@@ -228,6 +239,7 @@ void DirectionalLight::RenderShadowMap(ID3D11DeviceContext* pDeviceContext, cons
     // When done, reset Render Target
     ID3D11RenderTargetView* nullRTV = nullptr;
     pDeviceContext->OMSetRenderTargets(1, &nullRTV, nullptr);
+#endif
 }
 
 
@@ -0,0 +1,305 @@
+#include "pch.h"
+
+#undef main
+#include <chrono>
+#include <cstring>
+#include <string>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include "Renderer.h"
+#include "Utils.h"
+#include "ConsoleTextSettings.h"
+
+using namespace dae;
+
+// Last level cache misses of the whole process (all threads), read from the Linux perf counters.
+// Not every machine exposes them (VMs, perf_event_paranoid), then the count is just not reported
+class CacheMissCounter final
+{
+public:
+	CacheMissCounter()
+	{
+#if defined(__linux__)
+		perf_event_attr attributes{};
+		attributes.type = PERF_TYPE_HARDWARE;
+		attributes.size = sizeof(perf_event_attr);
+		attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+		attributes.disabled = 1;
+		attributes.inherit = 1;
+		attributes.exclude_kernel = 1;
+		attributes.exclude_hv = 1;
+		m_FileDescriptor = static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+#endif
+	}
+	~CacheMissCounter()
+	{
+#if defined(__linux__)
+		if (m_FileDescriptor >= 0) close(m_FileDescriptor);
+#endif
+	}
+
+	CacheMissCounter(const CacheMissCounter&) = delete;
+	CacheMissCounter(CacheMissCounter&&) noexcept = delete;
+	CacheMissCounter& operator=(const CacheMissCounter&) = delete;
+	CacheMissCounter& operator=(CacheMissCounter&&) noexcept = delete;
+
+	bool IsAvailable() const { return m_FileDescriptor >= 0; }
+	void Start() const
+	{
+#if defined(__linux__)
+		if (IsAvailable()) ioctl(m_FileDescriptor, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+	}
+	void Stop() const
+	{
+#if defined(__linux__)
+		if (IsAvailable()) ioctl(m_FileDescriptor, PERF_EVENT_IOC_DISABLE, 0);
+#endif
+	}
+	uint64_t GetCount() const
+	{
+		uint64_t count{};
+#if defined(__linux__)
+		if (IsAvailable() and read(m_FileDescriptor, &count, sizeof(count)) != sizeof(count)) count = 0;
+#endif
+		return count;
+	}
+
+private:
+	int m_FileDescriptor{ -1 };
+};
+
+// Compares FastPow against std::pow over every (cosAlpha, glossiness) the specular shading can see
+void ReportSpecularAccuracy()
+{
+	constexpr float shininess{ 25.f };
+	constexpr int cosSteps{ 4096 };
+	constexpr int glossSteps{ 256 };
+
+	std::vector<float> vCos(cosSteps + 1);
+	for (int i{}; i <= cosSteps; ++i) vCos[i] = static_cast<float>(i) / cosSteps;
+
+	double maxAbsoluteError{};
+	double maxRelativeError{};
+	double exactSum{};
+	double fastSum{};
+	double exactMs{};
+	double fastMs{};
+	for (int gloss{}; gloss < glossSteps; ++gloss)
+	{
+		const float exponent = static_cast<float>(gloss) / (glossSteps - 1) * shininess;
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (float cosAlpha : vCos) exactSum += std::pow(cosAlpha, exponent);
+		auto end = std::chrono::high_resolution_clock::now();
+		exactMs += std::chrono::duration<double, std::milli>(end - start).count();
+
+		start = std::chrono::high_resolution_clock::now();
+		for (float cosAlpha : vCos) fastSum += FastPow(cosAlpha, exponent);
+		end = std::chrono::high_resolution_clock::now();
+		fastMs += std::chrono::duration<double, std::milli>(end - start).count();
+
+		for (float cosAlpha : vCos)
+		{
+			const double exact = std::pow(static_cast<double>(cosAlpha), static_cast<double>(exponent));
+			const double error = std::abs(FastPow(cosAlpha, exponent) - exact);
+			maxAbsoluteError = std::max(maxAbsoluteError, error);
+			// Relative error only means something where the highlight is visible at all
+			if (exact > 1.0 / 255.0) maxRelativeError = std::max(maxRelativeError, error / exact);
+		}
+	}
+
+	const double sampleCount = static_cast<double>(glossSteps) * (cosSteps + 1);
+	std::cout << BRIGHT_BLACK_TXT << "Specular power, FastPow against std::pow (" << sampleCount << " samples)\n";
+	std::cout << "   max absolute error " << maxAbsoluteError << ", max relative error " << maxRelativeError << "\n";
+	std::cout << "   std::pow " << exactMs * 1e6 / sampleCount << " ns, FastPow " << fastMs * 1e6 / sampleCount << " ns per call";
+	std::cout << " (sums " << exactSum << ", " << fastSum << ")\n";
+	std::cout << DEFAULT << "\n";
+}
+
+// Vertex cache efficiency of an OBJ in the order it is loaded in, and after the optimization every Mesh gets
+bool ReportVertexCache(const std::string& objPath)
+{
+	std::vector<Vertex> vVertices{};
+	std::vector<uint32_t> vIndices{};
+	if (!Utils::ParseOBJ(objPath, vVertices, vIndices))
+	{
+		std::cerr << "Failed to load " << objPath << "\n";
+		return false;
+	}
+	const Utils::VertexCacheStats loaded = Utils::SimulateVertexCache(vIndices, vVertices.size());
+
+	const auto start = std::chrono::high_resolution_clock::now();
+	Utils::OptimizeVertexCache(vVertices, vIndices);
+	const auto end = std::chrono::high_resolution_clock::now();
+	const Utils::VertexCacheStats optimized = Utils::SimulateVertexCache(vIndices, vVertices.size());
+
+	std::cout << BRIGHT_BLACK_TXT << "Vertex cache of " << objPath << " (" << vVertices.size() << " vertices, " << vIndices.size() / 3 << " triangles, ";
+	std::cout << VERTEX_CACHE_SIZE << " entry FIFO)\n";
+	std::cout << "   loaded order    ACMR " << loaded.acmr << ", ATVR " << loaded.atvr << "\n";
+	std::cout << "   optimized order ACMR " << optimized.acmr << ", ATVR " << optimized.atvr;
+	std::cout << " (" << std::chrono::duration<double, std::milli>(end - start).count() << " ms)\n";
+	std::cout << DEFAULT << "\n";
+	return true;
+}
+
+void PrintUsage()
+{
+	std::cout << DARK_YELLOW_TXT;
+	std::cout << "[Headless Software Rasterizer]\n";
+	std::cout << "   --width <pixels>    Framebuffer width (default 640)\n";
+	std::cout << "   --height <pixels>   Framebuffer height (default 480)\n";
+	std::cout << "   --frames <count>    Amount of frames to render (default 100)\n";
+	std::cout << "   --output <file>     Save the last frame as a BMP\n";
+	std::cout << "   --no-rotation       Disable the vehicle rotation\n";
+	std::cout << "   --no-tiles          Single threaded rasterization instead of tiled\n";
+	std::cout << "   --no-simd           Scalar rasterization instead of AVX2 (if the CPU has AVX2)\n";
+	std::cout << "   --deferred          Visibility buffer (deferred) shading instead of forward shading\n";
+	std::cout << "   --sampler <filter>  Texture filter: point (default), linear or anisotropic\n";
+	std::cout << "   --linear-textures   Row major texture layout instead of 4x4 texel tiles\n";
+	std::cout << "   --compact-vertices  Quantized software vertices and 16 bit indices\n";
+	std::cout << "   --no-lod            Always draw the meshes at full detail\n";
+	std::cout << "   --specular-accuracy Only report the error and cost of the approximated specular power\n";
+	std::cout << "   --vertex-cache <obj> Only report the vertex cache efficiency of an OBJ before and after optimizing it\n";
+	std::cout << DEFAULT << "\n";
+}
+
+int main(int argc, char* args[])
+{
+	int width = 640;
+	int height = 480;
+	int frameCount = 100;
+	bool rotate = true;
+	bool tiled = true;
+	bool simd = true;
+	bool deferred = false;
+	SamplerState samplerState = SamplerState::Point;
+	bool tiledTextures = true;
+	bool compactVertices = false;
+	bool lod = true;
+	std::string outputPath{};
+
+	for (int i{ 1 }; i < argc; ++i)
+	{
+		const bool hasValue = i + 1 < argc;
+		if (std::strcmp(args[i], "--width") == 0 and hasValue)			width = std::stoi(args[++i]);
+		else if (std::strcmp(args[i], "--height") == 0 and hasValue)	height = std::stoi(args[++i]);
+		else if (std::strcmp(args[i], "--frames") == 0 and hasValue)	frameCount = std::stoi(args[++i]);
+		else if (std::strcmp(args[i], "--output") == 0 and hasValue)	outputPath = args[++i];
+		else if (std::strcmp(args[i], "--no-rotation") == 0)			rotate = false;
+		else if (std::strcmp(args[i], "--no-tiles") == 0)				tiled = false;
+		else if (std::strcmp(args[i], "--no-simd") == 0)				simd = false;
+		else if (std::strcmp(args[i], "--deferred") == 0)				deferred = true;
+		else if (std::strcmp(args[i], "--linear-textures") == 0)		tiledTextures = false;
+		else if (std::strcmp(args[i], "--compact-vertices") == 0)		compactVertices = true;
+		else if (std::strcmp(args[i], "--no-lod") == 0)					lod = false;
+		else if (std::strcmp(args[i], "--specular-accuracy") == 0)
+		{
+			ReportSpecularAccuracy();
+			return 0;
+		}
+		else if (std::strcmp(args[i], "--vertex-cache") == 0 and hasValue)
+		{
+			return ReportVertexCache(args[++i]) ? 0 : 1;
+		}
+		else if (std::strcmp(args[i], "--sampler") == 0 and hasValue)
+		{
+			const std::string filter{ args[++i] };
+			if (filter == "point")				samplerState = SamplerState::Point;
+			else if (filter == "linear")		samplerState = SamplerState::Linear;
+			else if (filter == "anisotropic")	samplerState = SamplerState::Anisotropic;
+			else
+			{
+				PrintUsage();
+				return 1;
+			}
+		}
+		else
+		{
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	SDL_Init(0);
+
+	//Initialize "framework"
+	const auto pRenderer = new Renderer(width, height);
+	if (!rotate) pRenderer->ToggleMeshRotation();
+	if (!tiled) pRenderer->ToggleTiledRasterization();
+	if (!simd) pRenderer->ToggleSIMDRasterization();
+	if (deferred) pRenderer->ToggleDeferredShading();
+	if (samplerState != SamplerState::Point) pRenderer->SetSamplingState(samplerState);
+	if (!tiledTextures) pRenderer->ToggleTextureLayout();
+	if (compactVertices) pRenderer->CompactMeshVertices();
+	if (!lod) pRenderer->ToggleLOD();
+
+	// Fixed time step, so every run renders the exact same frames
+	constexpr float elapsedSec = 1.f / 60.f;
+
+	double totalMs{};
+	double minMs{ DBL_MAX };
+	double maxMs{};
+	uint64_t totalShaded{};
+	uint64_t totalDepthPass{};
+	uint64_t totalTriangles{};
+	uint64_t totalSavedTriangles{};
+	const CacheMissCounter cacheMisses{};
+	for (int frame{}; frame < frameCount; ++frame)
+	{
+		pRenderer->Update(elapsedSec);
+
+		const auto start = std::chrono::high_resolution_clock::now();
+		cacheMisses.Start();
+		pRenderer->Render();
+		cacheMisses.Stop();
+		const auto end = std::chrono::high_resolution_clock::now();
+
+		const double frameMs = std::chrono::duration<double, std::milli>(end - start).count();
+		totalMs += frameMs;
+		minMs = std::min(minMs, frameMs);
+		maxMs = std::max(maxMs, frameMs);
+		totalShaded += pRenderer->GetShadedPixelCount();
+		totalDepthPass += pRenderer->GetDepthPassCount();
+		totalTriangles += pRenderer->GetLODTriangleCount();
+		totalSavedTriangles += pRenderer->GetLODSavedTriangleCount();
+	}
+
+	if (frameCount > 0)
+	{
+		const double averageMs = totalMs / frameCount;
+		std::cout << BRIGHT_BLACK_TXT << width << "x" << height << ", " << frameCount << " frames\n";
+		std::cout << "   avg " << averageMs << " ms (" << 1000.0 / averageMs << " FPS)\n";
+		std::cout << "   min " << minMs << " ms, max " << maxMs << " ms\n";
+		// Forward shading runs the pixel shader for every pixel that passes the depth test
+		const uint64_t forwardShaded = totalDepthPass / frameCount;
+		const uint64_t shaded = totalShaded / frameCount;
+		std::cout << "   shaded " << shaded << " pixels per frame (forward " << forwardShaded;
+		if (forwardShaded > 0) std::cout << ", " << 100.0 * (1.0 - double(shaded) / double(forwardShaded)) << "% saved";
+		std::cout << ")\n";
+		// Triangles going into triangle setup, the LODs leave out the ones that would be (sub-)pixel sized
+		const uint64_t triangles = totalTriangles / frameCount;
+		const uint64_t savedTriangles = totalSavedTriangles / frameCount;
+		std::cout << "   " << triangles << " triangles per frame (LOD saved " << savedTriangles;
+		if (triangles + savedTriangles > 0) std::cout << ", " << 100.0 * double(savedTriangles) / double(triangles + savedTriangles) << "%";
+		std::cout << ")\n";
+		if (cacheMisses.IsAvailable())
+			std::cout << "   " << cacheMisses.GetCount() / frameCount << " cache misses per frame\n";
+		else
+			std::cout << "   cache misses not available (no hardware perf counters)\n";
+	}
+
+	if (!outputPath.empty() and !pRenderer->SaveBufferToImage(outputPath))
+		std::cout << DARK_RED_TXT << "Could not save frame to " << outputPath << "\n";
+
+	//Shutdown "framework"
+	delete pRenderer;
+
+	SDL_Quit();
+	std::cout << DEFAULT << "\n";
+	return 0;
+}
@@ -1,6 +1,8 @@
 #pragma once
+#include <bit>
 #include <cfloat>
 #include <cmath>
+#include <cstdint>
 
 namespace dae
 {
@@ -73,4 +75,40 @@ namespace dae
 		if (v > 1.f) return 1.f;
 		return v;
 	}
+
+	// Polynomial approximations for the specular power of the pixel shader, with a bounded error instead of std::pow.
+	// Absolute error of FastLog2 is below 2e-6 and relative error of FastExp2 below 3e-6,
+	// so FastPow(x, y) is off by less than 5e-5 relative for y up to 25 (the specular exponent)
+	inline float FastLog2(float x)
+	{
+		// x = m * 2^e, with m in [2/3, 4/3) so the polynomial only has to cover log2 around 1
+		const int32_t bits = std::bit_cast<int32_t>(x) - 0x3F2AAAAB;
+		const int32_t exponent = bits >> 23;
+		const float u = std::bit_cast<float>(std::bit_cast<int32_t>(x) - (exponent << 23)) - 1.f;
+
+		// Fitted log2(1 + u) for u in [-1/3, 1/3]
+		const float polynomial = 1.442728f + u * (-0.721440929f + u * (0.478408044f + u * (-0.356659856f + u * (0.332885532f + u * -0.29100898f))));
+		return static_cast<float>(exponent) + u * polynomial;
+	}
+	inline float FastExp2(float x)
+	{
+		// Far below 1 the result is as good as 0, clamped so it stays a normal float (denormals are slow)
+		x = x < -125.f ? -125.f : x;
+		x = x > 127.f ? 127.f : x;
+
+		// 2^x = 2^i * 2^f, with i the nearest integer (written straight into the exponent bits) and f in [-0.5, 0.5].
+		// Adding 1.5 * 2^23 rounds x to an integer in the low bits of the float
+		const float shifted = x + 12582912.f;
+		const int32_t integer = std::bit_cast<int32_t>(shifted) - 0x4B400000;
+		const float f = x - (shifted - 12582912.f);
+
+		// Fitted 2^f for f in [-0.5, 0.5]
+		const float fraction = 1.f + f * (0.693124192f + f * (0.240240982f + f * (0.055906432f + f * 0.00958287924f)));
+		return fraction * std::bit_cast<float>((integer + 127) << 23);
+	}
+	// Only for x >= 0, pow(0, 0) is 1 and pow(0, y) is 0 like std::pow
+	inline float FastPow(float x, float y)
+	{
+		return FastExp2(y * (x > 0.f ? FastLog2(x) : -FLT_MAX));
+	}
 }
\ No newline at end of file
@@ -2,6 +2,60 @@
 #include "Utils.h"
 #include <cassert>
 
+namespace
+{
+	// Octahedral encoding: the unit sphere folded onto the [-1; 1] square, so an object space normal fits in two channels
+	Vector2 EncodeOctahedral(const Vector3& normal)
+	{
+		const float invLength = 1.f / (std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z));
+		Vector2 encoded{ normal.x * invLength, normal.y * invLength };
+		if (normal.z < 0.f)
+		{
+			// The lower half folds over the diagonals
+			encoded = Vector2{ (1.f - std::abs(encoded.y)) * (encoded.x >= 0.f ? 1.f : -1.f),
+							   (1.f - std::abs(encoded.x)) * (encoded.y >= 0.f ? 1.f : -1.f) };
+		}
+		return encoded;
+	}
+	Vector3 DecodeOctahedral(const Vector2& encoded)
+	{
+		Vector3 normal{ encoded.x, encoded.y, 1.f - std::abs(encoded.x) - std::abs(encoded.y) };
+		if (normal.z < 0.f)
+		{
+			normal.x = (1.f - std::abs(encoded.y)) * (encoded.x >= 0.f ? 1.f : -1.f);
+			normal.y = (1.f - std::abs(encoded.x)) * (encoded.y >= 0.f ? 1.f : -1.f);
+		}
+		return normal;
+	}
+	uint32_t UnitToUnorm8(float value)
+	{
+		return static_cast<uint32_t>(std::clamp(value * 0.5f + 0.5f, 0.f, 1.f) * 255.f + 0.5f);
+	}
+
+	// Compact vertex quantization, see CompactVertexStreams
+	uint16_t ToUnorm16(float value, float minimum, float range)
+	{
+		return static_cast<uint16_t>(range > 0.f ? std::lround(std::clamp((value - minimum) / range, 0.f, 1.f) * 65535.f) : 0);
+	}
+	int16_t ToSnorm16(float value)
+	{
+		// Degenerate tangents (NaN) end up pointing along z instead
+		if (std::isnan(value)) return 0;
+		return static_cast<int16_t>(std::lround(std::clamp(value, -1.f, 1.f) * 32767.f));
+	}
+	// Same steps as the SIMD vertex stage takes, so both decode to the exact same vector. It is not normalized
+	Vector3 DecodeOctahedralSnorm16(int16_t encodedX, int16_t encodedY)
+	{
+		Vector3 normal{ static_cast<float>(encodedX) * CompactVertexStreams::m_SNORM_SCALE, static_cast<float>(encodedY) * CompactVertexStreams::m_SNORM_SCALE, 0.f };
+		normal.z = 1.f - std::abs(normal.x) - std::abs(normal.y);
+		// The lower half folds back over the diagonals
+		const float fold = -normal.z > 0.f ? -normal.z : 0.f;
+		normal.x += normal.x >= 0.f ? -fold : fold;
+		normal.y += normal.y >= 0.f ? -fold : fold;
+		return normal;
+	}
+}
+
 //--------------------------------------------------
 //    Constructors and Destructors
 //--------------------------------------------------
@@ -9,9 +63,29 @@ Mesh::Mesh(ID3D11Device* pDevice, const std::string& objFilePath, const std::str
 {
 	m_Transparency = hasTransparency;
 
-	// Parse the OBJ Mesh
-	Utils::ParseOBJ(objFilePath, m_vVertices, m_vIndices);
-
+	// Parse the OBJ Mesh, unless its binary cache from an earlier run is still up to date
+	MeshBounds bounds{};
+	if (!Utils::LoadMeshCache(objFilePath, m_vVertices, m_vIndices, m_vLODs, bounds)
+		and Utils::ParseOBJ(objFilePath, m_vVertices, m_vIndices))
+	{
+		// Triangles in post-transform vertex cache order, vertices in the order those triangles fetch them
+		Utils::OptimizeVertexCache(m_vVertices, m_vIndices);
+		bounds = Utils::CalculateMeshBounds(m_vVertices);
+		// Coarser versions for when the mesh is small on screen
+		m_vLODs = Utils::BuildMeshLODs(m_vVertices, m_vIndices, bounds);
+		Utils::WriteMeshCache(objFilePath, m_vVertices, m_vIndices, m_vLODs, bounds);
+	}
+	m_NumIndices = static_cast <uint32_t>(m_vIndices.size());
+	m_VertexCount = m_vVertices.size();
+	m_BoundingCenter = (bounds.min + bounds.max) * 0.5f;
+	m_BoundingRadius = bounds.radius;
+	BuildVertexStreams();
+
+#if defined(SOFTWARE_ONLY)
+	// Null GPU backend, there is no Effect, Input Layout or Buffers to create
+	(void)pDevice;
+	(void)effectPath;
+#else
 	// Get the Effect and Technique
 	m_pEffect = new Effect(pDevice, {effectPath.begin(), effectPath.end()});
 	if (m_pEffect->GetEffect()->IsValid()) m_pCurrentTechnique = m_pEffect->GetTechniqueByIndex(0);
@@ -76,7 +150,6 @@ Mesh::Mesh(ID3D11Device* pDevice, const std::string& objFilePath, const std::str
 		assert(false);
 
 	// Create Index Buffer
-	m_NumIndices = static_cast <uint32_t>(m_vIndices.size());
 	bd.Usage = D3D11_USAGE_IMMUTABLE;
 	bd.ByteWidth = sizeof(uint32_t) * m_NumIndices;
 	bd.BindFlags = D3D11_BIND_INDEX_BUFFER;
@@ -86,9 +159,11 @@ Mesh::Mesh(ID3D11Device* pDevice, const std::string& objFilePath, const std::str
 	result = pDevice->CreateBuffer(&bd, &initData, &m_pIndexBuffer);
 	if (FAILED(result))
 		assert(false);
+#endif
 }
 Mesh::~Mesh()
 {
+#if !defined(SOFTWARE_ONLY)
 	// Release resources
 	if(m_pIndexBuffer)		m_pIndexBuffer->Release();
 	if(m_pVertexBuffer)		m_pVertexBuffer->Release();
@@ -96,6 +171,7 @@ Mesh::~Mesh()
 
 
 	delete m_pEffect;
+#endif
 }
 
 //--------------------------------------------------
@@ -103,6 +179,9 @@ Mesh::~Mesh()
 //--------------------------------------------------
 void Mesh::RenderGPU(ID3D11DeviceContext* pDeviceContext) const
 {
+#if defined(SOFTWARE_ONLY)
+	(void)pDeviceContext;
+#else
 	//1. Set Primitive Topology
 	switch (m_PrimitiveTopology)
 	{
@@ -135,6 +214,7 @@ void Mesh::RenderGPU(ID3D11DeviceContext* pDeviceContext) const
 		m_pCurrentTechnique->GetPassByIndex(p)->Apply(0, pDeviceContext);
 		pDeviceContext->DrawIndexed(m_NumIndices, 0, 0);
 	}
+#endif
 }
 
 
@@ -143,26 +223,35 @@ void Mesh::RenderGPU(ID3D11DeviceContext* pDeviceContext) const
 //--------------------------------------------------
 
 // Sampling
-ColorRGB Mesh::SampleDiffuse(const Vector2& interpUV, float* alpha) const
+ColorRGB Mesh::SampleDiffuse(const Vector2& interpUV, const UVDerivatives& uvDerivatives, float* alpha) const
 {
 	if (m_upDiffuseTxt == nullptr) return {};
-	return m_upDiffuseTxt->Sample(interpUV, m_Transparency, alpha);
+	return m_upDiffuseTxt->Sample(interpUV, uvDerivatives, m_SamplerState, m_Transparency, alpha);
 }
-ColorRGB Mesh::SamplePhong(const Vector3& dirToLight, const Vector3& viewDir, const Vector3& interpNormal, const Vector2& interpUV, const float shininess) const
+MaterialSample Mesh::SampleMaterial(const Vector2& interpUV, const UVDerivatives& uvDerivatives, bool objectSpaceNormals) const
 {
-	if (m_upSpecularTxt == nullptr) return {};
-	if (m_upGlossTxt == nullptr) return {};
+	const Texture* pMaterialTxt = objectSpaceNormals ? m_upObjectSpaceMaterialTxt.get() : m_upMaterialTxt.get();
+	if (pMaterialTxt == nullptr) return {};
 
-	const float ks = m_upSpecularTxt->Sample(interpUV).b;
-	const float exp = m_upGlossTxt->Sample(interpUV).b * shininess;
+	// Normal x and y in red and green, specular in blue, glossiness in alpha
+	float glossiness{};
+	const ColorRGB material = pMaterialTxt->Sample(interpUV, uvDerivatives, m_SamplerState, true, &glossiness);
+	return MaterialSample{ { material.r, material.g }, material.b, glossiness };
+}
+ColorRGB Mesh::SamplePhong(const Vector3& dirToLight, const Vector3& viewDir, const Vector3& interpNormal, const MaterialSample& material, const float shininess) const
+{
+	if (!m_MaterialPhong) return {};
+
+	const float ks = material.specular;
+	const float exp = material.glossiness * shininess;
 
 	const Vector3 reflect = Vector3::Reflect(dirToLight, interpNormal);
 	const float cosAlpha{ std::max(Vector3::Dot(reflect, viewDir), 0.f) };
-	return ColorRGB(1, 1, 1) * ks * std::pow(cosAlpha, exp);
+	return ColorRGB(1, 1, 1) * ks * FastPow(cosAlpha, exp);
 }
-Vector3 Mesh::SampleNormalMap(const Vector3& interpNormal, const Vector3& interpTangent, const Vector2& interpUV) const
+Vector3 Mesh::SampleNormalMap(const Vector3& interpNormal, const Vector3& interpTangent, const MaterialSample& material) const
 {
-	if (m_upNormalTxt == nullptr) return { interpNormal };
+	if (!m_MaterialNormals) return { interpNormal };
 
 	// Calculate the tangent space matrix
 	Vector3 binormal = Vector3::Cross(interpNormal, interpTangent);
@@ -173,25 +262,289 @@ Vector3 Mesh::SampleNormalMap(const Vector3& interpNormal, const Vector3& interp
 		Vector3::Zero
 	);
 
-	// Sample the normal map
-	ColorRGB nrmlMap = m_upNormalTxt->Sample(interpUV);
-
-	// normal's X & Y are in range [0; 1], while Z is in range [0.5; 1]
-	Vector3 normal{ nrmlMap.r, nrmlMap.g, nrmlMap.b };
-	// remap normal X & Y to [-1; 1] and Z to [0; 1]
-	normal = 2.f * normal - Vector3(1.f, 1.f, 1.f);
+	// normal's X & Y are in range [0; 1], remap them to [-1; 1]
+	Vector3 normal{ 2.f * material.normal.x - 1.f, 2.f * material.normal.y - 1.f, 0.f };
+	// Z is not packed, it is whatever makes the normal unit length (always facing out of the surface)
+	normal.z = std::sqrt(std::max(1.f - normal.x * normal.x - normal.y * normal.y, 0.f));
 
 	normal = tangentSpaceAxis.TransformVector(normal);
 
 	return normal.Normalized();
 }
+Vector3 Mesh::SampleObjectSpaceNormal(const MaterialSample& material) const
+{
+	// Baked at load, so only the rotation of the mesh is left
+	const Vector3 normal = DecodeOctahedral({ 2.f * material.normal.x - 1.f, 2.f * material.normal.y - 1.f });
+	return m_WorldMatrix.TransformVector(normal).Normalized();
+}
+
+void Mesh::BuildVertexStreams()
+{
+	const size_t vertexCount = m_vVertices.size();
+	for (std::vector<float>* pStream : { &m_VertexStreams.positionX, &m_VertexStreams.positionY, &m_VertexStreams.positionZ,
+		&m_VertexStreams.normalX, &m_VertexStreams.normalY, &m_VertexStreams.normalZ,
+		&m_VertexStreams.tangentX, &m_VertexStreams.tangentY, &m_VertexStreams.tangentZ,
+		&m_VertexStreams.u, &m_VertexStreams.v })
+	{
+		pStream->resize(vertexCount);
+	}
+
+	for (size_t index{}; index < vertexCount; ++index)
+	{
+		const Vertex& vertex = m_vVertices[index];
+		m_VertexStreams.positionX[index] = vertex.position.x;
+		m_VertexStreams.positionY[index] = vertex.position.y;
+		m_VertexStreams.positionZ[index] = vertex.position.z;
+		m_VertexStreams.normalX[index] = vertex.normal.x;
+		m_VertexStreams.normalY[index] = vertex.normal.y;
+		m_VertexStreams.normalZ[index] = vertex.normal.z;
+		m_VertexStreams.tangentX[index] = vertex.tangent.x;
+		m_VertexStreams.tangentY[index] = vertex.tangent.y;
+		m_VertexStreams.tangentZ[index] = vertex.tangent.z;
+		m_VertexStreams.u[index] = vertex.uv.x;
+		m_VertexStreams.v[index] = vertex.uv.y;
+	}
+}
+
+void Mesh::CompactVertices()
+{
+	if (m_CompactVertices or m_vVertices.empty()) return;
+
+	Vector3 positionMin{ m_vVertices.front().position };
+	Vector3 positionMax{ positionMin };
+	Vector2 uvMin{ m_vVertices.front().uv };
+	Vector2 uvMax{ uvMin };
+	const ColorRGB& firstColor = m_vVertices.front().color;
+	bool uniformColor{ true };
+	for (const Vertex& vertex : m_vVertices)
+	{
+		positionMin = Vector3::Min(positionMin, vertex.position);
+		positionMax = Vector3::Max(positionMax, vertex.position);
+		uvMin = Vector2::Min(uvMin, vertex.uv);
+		uvMax = Vector2::Max(uvMax, vertex.uv);
+		uniformColor = uniformColor and vertex.color.r == firstColor.r and vertex.color.g == firstColor.g and vertex.color.b == firstColor.b;
+	}
+	const Vector3 positionRange = positionMax - positionMin;
+	const Vector2 uvRange = uvMax - uvMin;
+
+	constexpr float unormMax{ 65535.f };
+	CompactVertexStreams& streams = m_CompactStreams;
+	streams.positionScale = positionRange / unormMax;
+	streams.positionOffset = positionMin;
+	streams.uvScale = uvRange / unormMax;
+	streams.uvOffset = uvMin;
+	streams.uniformColor = firstColor;
+
+	const size_t vertexCount = m_vVertices.size();
+	const bool hasTangents = HasTangents();
+	for (std::vector<uint16_t>* pStream : { &streams.positionX, &streams.positionY, &streams.positionZ, &streams.u, &streams.v })
+		pStream->resize(vertexCount);
+	streams.normalX.resize(vertexCount);
+	streams.normalY.resize(vertexCount);
+	// Meshes with an object space normal map do without tangents
+	if (hasTangents)
+	{
+		streams.tangentX.resize(vertexCount);
+		streams.tangentY.resize(vertexCount);
+	}
+	if (!uniformColor) streams.colors.resize(vertexCount);
+
+	for (size_t index{}; index < vertexCount; ++index)
+	{
+		const Vertex& vertex = m_vVertices[index];
+		streams.positionX[index] = ToUnorm16(vertex.position.x, positionMin.x, positionRange.x);
+		streams.positionY[index] = ToUnorm16(vertex.position.y, positionMin.y, positionRange.y);
+		streams.positionZ[index] = ToUnorm16(vertex.position.z, positionMin.z, positionRange.z);
+		streams.u[index] = ToUnorm16(vertex.uv.x, uvMin.x, uvRange.x);
+		streams.v[index] = ToUnorm16(vertex.uv.y, uvMin.y, uvRange.y);
+
+		const Vector2 normal = EncodeOctahedral(vertex.normal);
+		streams.normalX[index] = ToSnorm16(normal.x);
+		streams.normalY[index] = ToSnorm16(normal.y);
+		if (hasTangents)
+		{
+			const Vector2 tangent = EncodeOctahedral(vertex.tangent);
+			streams.tangentX[index] = ToSnorm16(tangent.x);
+			streams.tangentY[index] = ToSnorm16(tangent.y);
+		}
+		if (!uniformColor) streams.colors[index] = vertex.color;
+	}
+
+	// Every index fits in 16 bits for meshes up to 65536 vertices
+	if (vertexCount <= 65536)
+	{
+		m_vShortIndices.assign(m_vIndices.begin(), m_vIndices.end());
+		std::vector<uint32_t>{}.swap(m_vIndices);
+		for (MeshLOD& lod : m_vLODs)
+		{
+			lod.shortIndices.assign(lod.indices.begin(), lod.indices.end());
+			std::vector<uint32_t>{}.swap(lod.indices);
+		}
+	}
+
+	// Nothing reads the full precision software vertices anymore, the hardware buffers already have their own copy
+	std::vector<Vertex>{}.swap(m_vVertices);
+	m_VertexStreams = VertexStreams{};
+	m_CompactVertices = true;
+}
+Vertex Mesh::DecodeVertex(int index) const
+{
+	if (!m_CompactVertices) return m_vVertices[index];
+
+	const CompactVertexStreams& streams = m_CompactStreams;
+	Vertex vertex{};
+	vertex.position = { static_cast<float>(streams.positionX[index]) * streams.positionScale.x + streams.positionOffset.x,
+						static_cast<float>(streams.positionY[index]) * streams.positionScale.y + streams.positionOffset.y,
+						static_cast<float>(streams.positionZ[index]) * streams.positionScale.z + streams.positionOffset.z };
+	vertex.color = streams.colors.empty() ? streams.uniformColor : streams.colors[index];
+	vertex.uv = { static_cast<float>(streams.u[index]) * streams.uvScale.x + streams.uvOffset.x,
+				  static_cast<float>(streams.v[index]) * streams.uvScale.y + streams.uvOffset.y };
+	vertex.normal = DecodeOctahedralSnorm16(streams.normalX[index], streams.normalY[index]);
+	if (!streams.tangentX.empty()) vertex.tangent = DecodeOctahedralSnorm16(streams.tangentX[index], streams.tangentY[index]);
+	return vertex;
+}
+
+Texture* Mesh::BakeObjectSpaceNormalMap()
+{
+	// Rasterize every triangle in texture space, every covered texel gets its tangent space normal moved to object space
+	// with the interpolated tangent frame (built like SampleNormalMap does), stored octahedral encoded in red and green
+	const int width = m_upNormalTxt->GetWidth();
+	const int height = m_upNormalTxt->GetHeight();
+	// Texels no triangle covers point up (0, 0, 1)
+	constexpr uint32_t upTexel{ 0xFF000000 | (128 << 16) | (128 << 8) };
+	std::vector<uint32_t> vTexels(static_cast<size_t>(width) * height, upTexel);
+	std::vector<uint8_t> vCovered(vTexels.size());
+	// The first triangle to cover a texel owns it, its normal is kept to compare the later ones against
+	std::vector<Vector3> vOwnerNormals(vTexels.size());
+
+	const size_t triangleCount = m_PrimitiveTopology == PrimitiveTopology::TriangleList ? m_vIndices.size() / 3 : std::max<size_t>(m_vIndices.size(), 2) - 2;
+	const size_t indexStride = m_PrimitiveTopology == PrimitiveTopology::TriangleList ? 3 : 1;
+	m_vTangentSpaceTriangles.assign(triangleCount, 0);
+	for (size_t triangle{}; triangle < triangleCount; ++triangle)
+	{
+		// The winding does not matter here, only which texels the triangle covers
+		const Vertex& v0 = m_vVertices[m_vIndices[triangle * indexStride]];
+		const Vertex& v1 = m_vVertices[m_vIndices[triangle * indexStride + 1]];
+		const Vertex& v2 = m_vVertices[m_vIndices[triangle * indexStride + 2]];
+
+		const Vector2 p0{ v0.uv.x * width, v0.uv.y * height };
+		const Vector2 p1{ v1.uv.x * width, v1.uv.y * height };
+		const Vector2 p2{ v2.uv.x * width, v2.uv.y * height };
+		const float area = Vector2::Cross(p1 - p0, p2 - p0);
+		if (std::abs(area) < FLT_EPSILON) continue;
+		const float invArea = 1.f / area;
+
+		const int minX = static_cast<int>(std::floor(std::min({ p0.x, p1.x, p2.x })));
+		const int minY = static_cast<int>(std::floor(std::min({ p0.y, p1.y, p2.y })));
+		const int maxX = static_cast<int>(std::ceil(std::max({ p0.x, p1.x, p2.x })));
+		const int maxY = static_cast<int>(std::ceil(std::max({ p0.y, p1.y, p2.y })));
+		for (int y{ minY }; y < maxY; ++y)
+		{
+			for (int x{ minX }; x < maxX; ++x)
+			{
+				// Texel centers, with a little slack so texels on shared edges are never missed
+				constexpr float edgeTolerance{ -1e-4f };
+				const Vector2 center{ x + 0.5f, y + 0.5f };
+				const float w0 = Vector2::Cross(p2 - p1, center - p1) * invArea;
+				const float w1 = Vector2::Cross(p0 - p2, center - p2) * invArea;
+				const float w2 = 1.f - w0 - w1;
+				if (w0 < edgeTolerance or w1 < edgeTolerance or w2 < edgeTolerance) continue;
+
+				const Vector3 normal = (v0.normal * w0 + v1.normal * w1 + v2.normal * w2).Normalized();
+				const Vector3 tangent = (v0.tangent * w0 + v1.tangent * w1 + v2.tangent * w2).Normalized();
+				const Matrix tangentSpaceAxis{ tangent, Vector3::Cross(normal, tangent), normal, Vector3::Zero };
+
+				// UVs outside [0; 1] wrap, like the sampler
+				const int texelX = (x % width + width) % width;
+				const int texelY = (y % height + height) % height;
+				const uint32_t texel = m_upNormalTxt->GetTexel(texelX, texelY);
+				Vector3 tangentNormal{ ((texel >> 16) & 0xFF) / 255.f * 2.f - 1.f, ((texel >> 8) & 0xFF) / 255.f * 2.f - 1.f, 0.f };
+				tangentNormal.z = std::sqrt(std::max(1.f - tangentNormal.x * tangentNormal.x - tangentNormal.y * tangentNormal.y, 0.f));
+
+				const Vector3 objectNormal = tangentSpaceAxis.TransformVector(tangentNormal).Normalized();
+				const size_t index = static_cast<size_t>(width) * texelY + texelX;
+				if (vCovered[index])
+				{
+					// Mirrored or reused uv islands map one texel to differently oriented surfaces,
+					// such a triangle keeps sampling the tangent space map instead
+					constexpr float minSharedNormalDot{ 0.99f };
+					if (Vector3::Dot(vOwnerNormals[index], objectNormal) < minSharedNormalDot) m_vTangentSpaceTriangles[triangle] = 1;
+					continue;
+				}
+
+				const Vector2 encoded = EncodeOctahedral(objectNormal);
+				vTexels[index] = 0xFF000000 | (UnitToUnorm8(encoded.x) << 16) | (UnitToUnorm8(encoded.y) << 8);
+				vCovered[index] = 1;
+				vOwnerNormals[index] = objectNormal;
+			}
+		}
+	}
+
+	// Bilinear filtering and the mip levels also read the texels just outside the uv islands,
+	// grow the islands a few texels so those read a neighbouring normal instead of nothing
+	constexpr int dilationCount{ 8 };
+	for (int dilation{}; dilation < dilationCount; ++dilation)
+	{
+		std::vector<uint8_t> vGrown{ vCovered };
+		for (int y{}; y < height; ++y)
+		{
+			for (int x{}; x < width; ++x)
+			{
+				const size_t index = static_cast<size_t>(width) * y + x;
+				if (vCovered[index]) continue;
+				for (const Int2& offset : { Int2{ -1, 0 }, Int2{ 1, 0 }, Int2{ 0, -1 }, Int2{ 0, 1 } })
+				{
+					const int neighbourX = x + offset.x;
+					const int neighbourY = y + offset.y;
+					if (neighbourX < 0 or neighbourX >= width or neighbourY < 0 or neighbourY >= height) continue;
+					const size_t neighbour = static_cast<size_t>(width) * neighbourY + neighbourX;
+					if (!vCovered[neighbour]) continue;
+					vTexels[index] = vTexels[neighbour];
+					vGrown[index] = 1;
+					break;
+				}
+			}
+		}
+		vCovered.swap(vGrown);
+	}
+
+	return Texture::CreateFromTexels(width, height, std::move(vTexels));
+}
 
 // Accessors
 std::vector<Vertex>& Mesh::GetVerticesByReference()			{ return m_vVertices; }
 std::vector<VertexOut>& Mesh::GetVerticesOutByReference()	{ return m_vVerticesOut; }
+std::vector<VertexOut>& Mesh::GetVerticesScreenByReference(){ return m_vVerticesScreen; }
+std::vector<uint8_t>& Mesh::GetClipFlagsByReference()		{ return m_vClipFlags; }
+const VertexStreams& Mesh::GetVertexStreams() const		{ return m_VertexStreams; }
 std::vector<uint32_t>& Mesh::GetIndicesByReference()		{ return m_vIndices; }
+const CompactVertexStreams& Mesh::GetCompactVertexStreams() const	{ return m_CompactStreams; }
+std::vector<uint16_t>& Mesh::GetShortIndicesByReference()	{ return m_vShortIndices; }
+size_t Mesh::GetVertexCount() const							{ return m_VertexCount; }
+bool Mesh::HasCompactVertices() const						{ return m_CompactVertices; }
+bool Mesh::HasShortIndices() const							{ return !m_vShortIndices.empty(); }
+size_t Mesh::GetVertexMemorySize() const
+{
+	const auto sizeOf = [](const auto& vector) { return vector.size() * sizeof(vector[0]); };
+	const CompactVertexStreams& compact = m_CompactStreams;
+	size_t lodSize{};
+	for (const MeshLOD& lod : m_vLODs) lodSize += sizeOf(lod.indices) + sizeOf(lod.shortIndices) + sizeOf(lod.sourceTriangles);
+	return sizeOf(m_vVertices) + sizeOf(m_vIndices) + sizeOf(m_vShortIndices) + lodSize
+		+ sizeOf(m_VertexStreams.positionX) * 3 + sizeOf(m_VertexStreams.normalX) * 3 + sizeOf(m_VertexStreams.tangentX) * 3 + sizeOf(m_VertexStreams.u) * 2
+		+ sizeOf(compact.positionX) * 3 + sizeOf(compact.normalX) * 2 + sizeOf(compact.tangentX) * 2 + sizeOf(compact.u) * 2 + sizeOf(compact.colors);
+}
 PrimitiveTopology Mesh::GetPrimitiveTopology() const		{ return m_PrimitiveTopology; }
 bool Mesh::HasTransparency() const							{ return m_Transparency; }
+bool Mesh::HasObjectSpaceNormals() const					{ return m_ObjectSpaceNormals; }
+bool Mesh::HasTangents() const								{ return !m_ObjectSpaceNormals or !m_vTangentSpaceTriangles.empty(); }
+bool Mesh::IsTangentSpaceTriangle(int triangleIndex) const	{ return !m_vTangentSpaceTriangles.empty() and m_vTangentSpaceTriangles[triangleIndex]; }
+int Mesh::GetLODCount() const								{ return static_cast<int>(m_vLODs.size()) + 1; }
+const MeshLOD& Mesh::GetLOD(int lod) const					{ return m_vLODs[lod - 1]; }
+float Mesh::GetLODError(int lod) const						{ return lod > 0 ? m_vLODs[lod - 1].error : 0.f; }
+size_t Mesh::GetLODTriangleCount(int lod) const				{ return lod > 0 ? m_vLODs[lod - 1].sourceTriangles.size() : m_NumIndices / 3; }
+int Mesh::GetCurrentLOD() const								{ return m_CurrentLOD; }
+const Vector3& Mesh::GetBoundingCenter() const				{ return m_BoundingCenter; }
+float Mesh::GetBoundingRadius() const						{ return m_BoundingRadius; }
 
 ID3D11Buffer* Mesh::GetVertexBuffer() const
 {
@@ -210,30 +563,11 @@ uint32_t Mesh::GetNumIndices() const
 
 // Mutators
 void Mesh::SetPrimitiveTopology(const PrimitiveTopology& primitiveTopology) { m_PrimitiveTopology = primitiveTopology; }
-
-
-//--------------------------------------------------
-//    DirectX
-//--------------------------------------------------
-
-// Mutators
-void Mesh::SetTextureSamplingState(SamplerState samplerState)
+void Mesh::SetCurrentLOD(int lod) { m_CurrentLOD = std::clamp(lod, 0, GetLODCount() - 1); }
+void Mesh::SetTextureLayout(TextureLayout layout)
 {
-	switch (samplerState)
-	{
-	case SamplerState::Point:
-		m_pCurrentTechnique = m_pEffect->GetTechniqueByName("PointSamplingTechnique");
-		break;
-	case SamplerState::Linear:
-		m_pCurrentTechnique = m_pEffect->GetTechniqueByName("LinearSamplingTechnique");
-		break;
-	case SamplerState::Anisotropic:
-		m_pCurrentTechnique = m_pEffect->GetTechniqueByName("AnisotropicSamplingTechnique");
-		break;
-	default:
-		m_pCurrentTechnique = m_pEffect->GetTechniqueByIndex(0);
-		break;
-	}
+	for (Texture* pTexture : { m_upDiffuseTxt.get(), m_upNormalTxt.get(), m_upGlossTxt.get(), m_upSpecularTxt.get(), m_upMaterialTxt.get(), m_upObjectSpaceMaterialTxt.get() })
+		if (pTexture) pTexture->SetLayout(layout);
 }
 
 
@@ -246,29 +580,104 @@ void Mesh::LoadDiffuseTexture(const std::string& path, ID3D11Device* pDevice)
 {
 	Texture* texture = Texture::LoadFromFile(path, pDevice);
 	m_upDiffuseTxt.reset(texture);
+#if !defined(SOFTWARE_ONLY)
 	m_pEffect->LoadTexture("gDiffuseMap", texture);
+#endif
 }
 void Mesh::LoadNormalMap(const std::string& path, ID3D11Device* pDevice)
 {
 	Texture* texture = Texture::LoadFromFile(path, pDevice);
 	m_upNormalTxt.reset(texture);
+#if !defined(SOFTWARE_ONLY)
 	m_pEffect->LoadTexture("gNormalMap", texture);
+#endif
 }
 void Mesh::LoadGlossinessMap(const std::string& path, ID3D11Device* pDevice)
 {
 	Texture* texture = Texture::LoadFromFile(path, pDevice);
 	m_upGlossTxt.reset(texture);
+#if !defined(SOFTWARE_ONLY)
 	m_pEffect->LoadTexture("gGlossinessMap", texture);
+#endif
 }
 void Mesh::LoadSpecularMap(const std::string& path, ID3D11Device* pDevice)
 {
 	Texture* texture = Texture::LoadFromFile(path, pDevice);
 	m_upSpecularTxt.reset(texture);
+#if !defined(SOFTWARE_ONLY)
 	m_pEffect->LoadTexture("gSpecularMap", texture);
+#endif
+}
+void Mesh::PackMaterialTextures(bool objectSpaceNormals)
+{
+	// Flat normal and no specular where a map is missing. The maps are read from their red channel, like the hardware shader does
+	constexpr uint8_t flatNormal{ 128 };
+	const auto packMaterial = [&](const Texture* pNormalTxt)
+	{
+		return Texture::CreatePacked({
+			TextureChannel{ pNormalTxt, Texture::m_RED_SHIFT, flatNormal },
+			TextureChannel{ pNormalTxt, Texture::m_GREEN_SHIFT, flatNormal },
+			TextureChannel{ m_upSpecularTxt.get(), Texture::m_RED_SHIFT, 0 },
+			TextureChannel{ m_upGlossTxt.get(), Texture::m_RED_SHIFT, 0 } });
+	};
+	m_upMaterialTxt.reset(packMaterial(m_upNormalTxt.get()));
+	m_MaterialNormals = m_upNormalTxt != nullptr;
+	m_MaterialPhong = m_upSpecularTxt != nullptr and m_upGlossTxt != nullptr;
+
+	if (objectSpaceNormals and m_upNormalTxt)
+	{
+		// The baked normal map only replaces the tangent space one in the software material
+		const std::unique_ptr<Texture> upObjectSpaceNormalTxt{ BakeObjectSpaceNormalMap() };
+		m_upObjectSpaceMaterialTxt.reset(packMaterial(upObjectSpaceNormalTxt.get()));
+		m_ObjectSpaceNormals = true;
+
+		if (std::find(m_vTangentSpaceTriangles.begin(), m_vTangentSpaceTriangles.end(), uint8_t{ 1 }) == m_vTangentSpaceTriangles.end())
+		{
+			// Every triangle samples the object space material, nothing reads the tangent space one or the tangents anymore
+			m_vTangentSpaceTriangles.clear();
+			m_upMaterialTxt.reset();
+			for (std::vector<float>* pStream : { &m_VertexStreams.tangentX, &m_VertexStreams.tangentY, &m_VertexStreams.tangentZ })
+				std::vector<float>{}.swap(*pStream);
+		}
+	}
+
+#if defined(SOFTWARE_ONLY)
+	// Nothing samples the separate maps anymore
+	m_upNormalTxt.reset();
+	m_upSpecularTxt.reset();
+	m_upGlossTxt.reset();
+#else
+	// The hardware rasterizer still samples the separate maps, only their software copies can go
+	for (Texture* pTexture : { m_upNormalTxt.get(), m_upSpecularTxt.get(), m_upGlossTxt.get() })
+		if (pTexture) pTexture->ReleaseTexels();
+#endif
 }
 
 // Mutators
 void Mesh::SetWorldMatrix(const Matrix& newWorldMatrix) { m_WorldMatrix = newWorldMatrix; }
+void Mesh::SetTextureSamplingState(SamplerState samplerState)
+{
+	// The software sampler reads it directly, the hardware one needs the matching technique
+	m_SamplerState = samplerState;
+
+#if !defined(SOFTWARE_ONLY)
+	switch (samplerState)
+	{
+	case SamplerState::Point:
+		m_pCurrentTechnique = m_pEffect->GetTechniqueByName("PointSamplingTechnique");
+		break;
+	case SamplerState::Linear:
+		m_pCurrentTechnique = m_pEffect->GetTechniqueByName("LinearSamplingTechnique");
+		break;
+	case SamplerState::Anisotropic:
+		m_pCurrentTechnique = m_pEffect->GetTechniqueByName("AnisotropicSamplingTechnique");
+		break;
+	default:
+		m_pCurrentTechnique = m_pEffect->GetTechniqueByIndex(0);
+		break;
+	}
+#endif
+}
 
 // Accessors
 const Matrix& Mesh::GetWorldMatrix() const { return m_WorldMatrix; }
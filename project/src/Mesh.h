@@ -26,6 +26,53 @@ struct VertexOut
 	Vector3 normal		{	   0.f, 0.f, 0.f };
 	Vector3 tangent		{	   0.f, 0.f, 0.f };
 };
+// Structure of arrays copy of the vertex attributes, so the software vertex stage can transform them in SIMD batches
+struct VertexStreams
+{
+	std::vector<float> positionX{}, positionY{}, positionZ{};
+	std::vector<float> normalX{}, normalY{}, normalZ{};
+	std::vector<float> tangentX{}, tangentY{}, tangentZ{};
+	std::vector<float> u{}, v{};
+};
+// Quantized copy of the vertex attributes (see Mesh::CompactVertices), the software vertex stage decodes it as it reads it.
+// Positions and uvs are 16 bit fractions of their bounds (value = quantized * scale + offset),
+// normals and tangents the octahedral x and y as 16 bit snorm
+struct CompactVertexStreams
+{
+	std::vector<uint16_t> positionX{}, positionY{}, positionZ{};
+	std::vector<int16_t> normalX{}, normalY{};
+	std::vector<int16_t> tangentX{}, tangentY{};
+	std::vector<uint16_t> u{}, v{};
+	Vector3 positionScale{}, positionOffset{};
+	Vector2 uvScale{}, uvOffset{};
+	// Only filled when not every vertex has the same color
+	std::vector<ColorRGB> colors{};
+	ColorRGB uniformColor{ colors::White };
+
+	static constexpr float m_SNORM_SCALE{ 1.f / 32767.f };
+};
+// Coarser version of a mesh (see Utils::SimplifyMesh), its triangles index the vertices of the full detail mesh
+struct MeshLOD
+{
+	std::vector<uint32_t> indices{};
+	std::vector<uint16_t> shortIndices{};		// replaces the indices once the mesh has compact vertices, when they fit
+	std::vector<uint32_t> sourceTriangles{};	// the full detail triangle every triangle is what is left of
+	float error{};								// root mean square distance the surface moved, in object space
+};
+// Object space bounding box, and the radius of the bounding sphere around its center
+struct MeshBounds
+{
+	Vector3 min{};
+	Vector3 max{};
+	float radius{};
+};
+// The scalar material maps of one sample, all read with a single fetch of the packed material texture
+struct MaterialSample
+{
+	Vector2 normal{};	// in [0; 1], tangent space x and y (z follows from them) or the octahedral encoded object space normal
+	float specular{};
+	float glossiness{};
+};
 enum class PrimitiveTopology
 {
 	TriangleList,
@@ -57,28 +104,54 @@ public:
 	//--------------------------------------------------
 
 	// Sampling
-	ColorRGB SampleDiffuse(const Vector2& interpUV, float* alpha) const;
-	ColorRGB SamplePhong(const Vector3& dirToLight, const Vector3& viewDir, const Vector3& interpNormal, const Vector2& interpUV, float shininess) const;
-	Vector3 SampleNormalMap(const Vector3& interpNormal, const Vector3& interpTangent, const Vector2& interpUV) const;
+	ColorRGB SampleDiffuse(const Vector2& interpUV, const UVDerivatives& uvDerivatives, float* alpha) const;
+	MaterialSample SampleMaterial(const Vector2& interpUV, const UVDerivatives& uvDerivatives, bool objectSpaceNormals = false) const;
+	ColorRGB SamplePhong(const Vector3& dirToLight, const Vector3& viewDir, const Vector3& interpNormal, const MaterialSample& material, float shininess) const;
+	Vector3 SampleNormalMap(const Vector3& interpNormal, const Vector3& interpTangent, const MaterialSample& material) const;
+	Vector3 SampleObjectSpaceNormal(const MaterialSample& material) const;
+
+	// Replaces the software copy of the vertices and indices with quantized ones (16 bit indices when they fit), for good.
+	// The hardware buffers keep full precision. Call after PackMaterialTextures, baking needs the full vertices
+	void CompactVertices();
+	// Full precision vertex, also of compact meshes (the normal and tangent are not normalized then)
+	Vertex DecodeVertex(int index) const;
 
 	// Accessors
 	std::vector<Vertex>& GetVerticesByReference();
 	std::vector<VertexOut>& GetVerticesOutByReference();
+	std::vector<VertexOut>& GetVerticesScreenByReference();
+	std::vector<uint8_t>& GetClipFlagsByReference();
+	const VertexStreams& GetVertexStreams() const;
 	std::vector<uint32_t>& GetIndicesByReference();
+	const CompactVertexStreams& GetCompactVertexStreams() const;
+	std::vector<uint16_t>& GetShortIndicesByReference();
+	size_t GetVertexCount() const;
+	// Software memory of the vertices and indices, full or compact
+	size_t GetVertexMemorySize() const;
+	bool HasCompactVertices() const;
+	bool HasShortIndices() const;
 	PrimitiveTopology GetPrimitiveTopology() const;
 	bool HasTransparency() const;
+	bool HasObjectSpaceNormals() const;
+	bool HasTangents() const;
+	bool IsTangentSpaceTriangle(int triangleIndex) const;
+	// LOD 0 is the full detail mesh, the coarser ones come from the simplifier and index the same vertices
+	int GetLODCount() const;
+	const MeshLOD& GetLOD(int lod) const;
+	float GetLODError(int lod) const;
+	size_t GetLODTriangleCount(int lod) const;
+	int GetCurrentLOD() const;
+	// Object space bounding sphere
+	const Vector3& GetBoundingCenter() const;
+	float GetBoundingRadius() const;
 	ID3D11Buffer* GetVertexBuffer() const;
 	ID3D11Buffer* GetIndexBuffer() const;
 	uint32_t GetNumIndices() const;
 
 	// Mutators
 	void SetPrimitiveTopology(const PrimitiveTopology& primitiveTopology);
-
-	//--------------------------------------------------
-	//    DirectX
-	//--------------------------------------------------
-	// Mutators
-	void SetTextureSamplingState(SamplerState samplerState);
+	void SetTextureLayout(TextureLayout layout);
+	void SetCurrentLOD(int lod);
 
 	//--------------------------------------------------
 	//    Shared
@@ -88,9 +161,14 @@ public:
 	void LoadNormalMap(const std::string& path, ID3D11Device* pDevice);
 	void LoadGlossinessMap(const std::string& path, ID3D11Device* pDevice);
 	void LoadSpecularMap(const std::string& path, ID3D11Device* pDevice);
+	// Packs the normal, specular and glossiness maps into one software material texture, call after loading them.
+	// Rigid meshes can bake their tangent space normal map to object space, then the software rasterizer needs no tangents.
+	// Triangles whose uvs overlap a differently oriented part of the mesh keep the tangent space material
+	void PackMaterialTextures(bool objectSpaceNormals = false);
 
 	// Mutators
 	void SetWorldMatrix(const Matrix& newWorldMatrix);
+	void SetTextureSamplingState(SamplerState samplerState);
 
 	// Accessors
 	const Matrix& GetWorldMatrix() const;
@@ -104,20 +182,43 @@ private:
 
 	std::vector<Vertex> m_vVertices{};
 	std::vector<VertexOut> m_vVerticesOut{};
+	std::vector<VertexOut> m_vVerticesScreen{};
+	std::vector<uint8_t> m_vClipFlags{};
+	VertexStreams m_VertexStreams{};
 
 	std::vector<uint32_t> m_vIndices{};
 	uint32_t m_NumIndices{};
 
+	CompactVertexStreams m_CompactStreams{};
+	std::vector<uint16_t> m_vShortIndices{};
+	size_t m_VertexCount{};
+	bool m_CompactVertices{ false };
+
+	std::vector<MeshLOD> m_vLODs{};		// LOD 1 and coarser
+	int m_CurrentLOD{};
+	Vector3 m_BoundingCenter{};
+	float m_BoundingRadius{};
+
 	PrimitiveTopology m_PrimitiveTopology{ PrimitiveTopology::TriangleList };
 	bool m_Transparency{ false };
 
 	//--------------------------------------------------
 	//    Software
 	//--------------------------------------------------
+	void BuildVertexStreams();
+	Texture* BakeObjectSpaceNormalMap();
+
+	SamplerState m_SamplerState{ SamplerState::Point };
 	std::unique_ptr<Texture> m_upDiffuseTxt;
 	std::unique_ptr<Texture> m_upNormalTxt;
 	std::unique_ptr<Texture> m_upGlossTxt;
 	std::unique_ptr<Texture> m_upSpecularTxt;
+	std::unique_ptr<Texture> m_upMaterialTxt;
+	std::unique_ptr<Texture> m_upObjectSpaceMaterialTxt;
+	std::vector<uint8_t> m_vTangentSpaceTriangles{};
+	bool m_MaterialNormals{ false };
+	bool m_MaterialPhong{ false };
+	bool m_ObjectSpaceNormals{ false };
 
 
 	//--------------------------------------------------
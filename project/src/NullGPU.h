@@ -0,0 +1,24 @@
+#pragma once
+
+//--------------------------------------------------
+//    Null GPU Backend
+//--------------------------------------------------
+// Used instead of the DirectX headers when building the software rasterizer only (SOFTWARE_ONLY).
+// The DirectX interfaces are only declared, so the shared classes keep their signatures,
+// but every device, context and resource pointer stays nullptr and no GPU call is ever made.
+
+using HRESULT = long;
+
+struct IDXGISwapChain;
+struct ID3D11Device;
+struct ID3D11DeviceContext;
+struct ID3D11Resource;
+struct ID3D11Buffer;
+struct ID3D11Texture2D;
+struct ID3D11InputLayout;
+struct ID3D11ShaderResourceView;
+struct ID3D11RenderTargetView;
+struct ID3D11DepthStencilView;
+struct ID3D11RasterizerState;
+struct ID3DX11Effect;
+struct ID3DX11EffectTechnique;
@@ -7,6 +7,12 @@ enum class SamplerState
 	Anisotropic
 };
 
+enum class TextureLayout
+{
+	Linear,			// Row after row
+	Tiled			// 4x4 texel blocks (one cache line) after each other, row after row of blocks
+};
+
 enum class ShadingMode
 {
 	ObservedArea,	// Lambert Cosine Law
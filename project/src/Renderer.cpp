@@ -5,9 +5,64 @@
 #include <array>
 #include <execution>
 #include <iostream>
+#include <bit>
+#include <numeric>
+#include <utility>
 #include "ConsoleTextSettings.h"
 #include "DirectionalLight.h"
 
+#if defined(AVX2_KERNELS)
+namespace
+{
+	// The 8 wide kernels of the software rasterizer, only called when the CPU supports AVX2
+
+	// InterpolateDepth for 8 pixels, in the same operation order
+	AVX2_TARGET __m256 InterpolateDepth8(const __m256& numerator, const __m256& d0, const __m256& d1, const __m256& d2,
+		const __m256& b0, const __m256& b1, const __m256& b2)
+	{
+		__m256 denominator = _mm256_mul_ps(_mm256_mul_ps(b0, d1), d2);
+		denominator = _mm256_add_ps(denominator, _mm256_mul_ps(_mm256_mul_ps(b1, d0), d2));
+		denominator = _mm256_add_ps(denominator, _mm256_mul_ps(_mm256_mul_ps(b2, d0), d1));
+		return _mm256_div_ps(numerator, denominator);
+	}
+	// Column c of (x, y, z) * m, without the translation row
+	AVX2_TARGET __m256 Transform8(const __m256 (&m)[4][4], int c, const __m256& x, const __m256& y, const __m256& z)
+	{
+		return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[0][c], x), _mm256_mul_ps(m[1][c], y)), _mm256_mul_ps(m[2][c], z));
+	}
+	AVX2_TARGET void Normalize8(__m256& x, __m256& y, __m256& z)
+	{
+		const __m256 magnitude = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), _mm256_mul_ps(z, z)));
+		const __m256 invMagnitude = _mm256_div_ps(_mm256_set1_ps(1.f), magnitude);
+		x = _mm256_mul_ps(x, invMagnitude);
+		y = _mm256_mul_ps(y, invMagnitude);
+		z = _mm256_mul_ps(z, invMagnitude);
+	}
+	// value = quantized * scale + offset, for 8 16 bit fractions of the bounds
+	AVX2_TARGET __m256 LoadUnorm16x8(const uint16_t* pValues, float scale, float offset)
+	{
+		const __m256 value = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pValues))));
+		return _mm256_add_ps(_mm256_mul_ps(value, _mm256_set1_ps(scale)), _mm256_set1_ps(offset));
+	}
+	// Octahedral x and y in 16 bit snorm to the (not normalized) vector, like Mesh::DecodeVertex
+	AVX2_TARGET void LoadOctahedral8(const int16_t* pX, const int16_t* pY, __m256& x, __m256& y, __m256& z)
+	{
+		const __m256 snormScale = _mm256_set1_ps(CompactVertexStreams::m_SNORM_SCALE);
+		const __m256 signMask = _mm256_set1_ps(-0.f);
+		const __m256 zero = _mm256_setzero_ps();
+		x = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pX)))), snormScale);
+		y = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pY)))), snormScale);
+		z = _mm256_sub_ps(_mm256_sub_ps(_mm256_set1_ps(1.f), _mm256_andnot_ps(signMask, x)), _mm256_andnot_ps(signMask, y));
+
+		// The lower half folds back over the diagonals
+		const __m256 fold = _mm256_max_ps(_mm256_xor_ps(z, signMask), zero);
+		const __m256 negativeFold = _mm256_xor_ps(fold, signMask);
+		x = _mm256_add_ps(x, _mm256_blendv_ps(fold, negativeFold, _mm256_cmp_ps(x, zero, _CMP_GE_OQ)));
+		y = _mm256_add_ps(y, _mm256_blendv_ps(fold, negativeFold, _mm256_cmp_ps(y, zero, _CMP_GE_OQ)));
+	}
+}
+#endif
+
 namespace dae {
 	//--------------------------------------------------
 	//    Constructors and Destructors
@@ -20,11 +75,22 @@ namespace dae {
 
 		// Create Buffers
 		m_pFrontBuffer = SDL_GetWindowSurface(pWindow);
-		m_pBackBuffer = SDL_CreateRGBSurface(0, m_Width, m_Height, 32, 0, 0, 0, 0);
-		m_pBackBufferPixels = static_cast<uint32_t*>(m_pBackBuffer->pixels);
+		CreateBackBuffer();
 
 		m_pDepthBufferPixels = new float[(m_Width * m_Height)];
+		m_pVisibilityBufferPixels = new uint32_t[(m_Width * m_Height)];
+		InitializeTiles();
+		InitializeHiZ();
+#if defined(AVX2_KERNELS)
+		m_SIMDSupported = SDL_HasAVX2() == SDL_TRUE;
+		m_SIMDRasterization = m_SIMDSupported;
+#endif
 
+#if defined(SOFTWARE_ONLY)
+		// Null GPU backend, only the software rasterizer is available
+		m_IsInitialized = true;
+		m_SoftwareRasterizer = true;
+#else
 		//Initialize DirectX pipeline
 		const HRESULT result = InitializeDirectX();
 		if (result == S_OK)
@@ -36,28 +102,34 @@ namespace dae {
 		{
 			std::cout << "DirectX initialization failed!\n";
 		}
+#endif
 
-		// Initialize Meshes and Effects
-		m_vMeshes["0Vehicle"] = new Mesh(m_pDevice, "resources/vehicle.obj", "resources/Vehicle.fx", false);
-		m_vMeshes["0Vehicle"]->LoadDiffuseTexture("resources/vehicle_diffuse.png", m_pDevice);
-		m_vMeshes["0Vehicle"]->LoadNormalMap("resources/vehicle_normal.png", m_pDevice);
-		m_vMeshes["0Vehicle"]->LoadSpecularMap("resources/vehicle_specular.png", m_pDevice);
-		m_vMeshes["0Vehicle"]->LoadGlossinessMap("resources/vehicle_gloss.png", m_pDevice);
-		m_vMeshes["0Vehicle"]->SetWorldMatrix(Matrix::CreateTranslation(0.f, 0.f, 50.f));
-
-		m_vMeshes["1Fire"] = new Mesh(m_pDevice, "resources/fireFX.obj", "resources/Fire.fx", true);
-		m_vMeshes["1Fire"]->LoadDiffuseTexture("resources/fireFX_diffuse.png", m_pDevice);
-		m_vMeshes["1Fire"]->SetWorldMatrix(Matrix::CreateTranslation(0.f, 0.f, 50.f));
+		LoadScene();
+	}
+#if defined(SOFTWARE_ONLY)
+	Renderer::Renderer(int width, int height) :
+		m_Width(width),
+		m_Height(height)
+	{
+		// Create Buffers, without a window the BackBuffer is the final (offscreen) framebuffer
+		CreateBackBuffer();
 
+		m_pDepthBufferPixels = new float[(m_Width * m_Height)];
+		m_pVisibilityBufferPixels = new uint32_t[(m_Width * m_Height)];
+		InitializeTiles();
+		InitializeHiZ();
+#if defined(AVX2_KERNELS)
+		m_SIMDSupported = SDL_HasAVX2() == SDL_TRUE;
+		m_SIMDRasterization = m_SIMDSupported;
+#endif
 
-		m_vMeshes["0Plane"] = new Mesh(m_pDevice, "resources/plane.obj", "resources/Plane.fx", false);
-		m_vMeshes["0Plane"]->LoadDiffuseTexture("resources/plane_diffuse.png", m_pDevice);
-		m_vMeshes["0Plane"]->SetWorldMatrix(Matrix::CreateTranslation(0.f, -10.f, 50.f));
+		// Null GPU backend, only the software rasterizer is available
+		m_IsInitialized = true;
+		m_SoftwareRasterizer = true;
 
-		// Initialize Camera
-		m_Camera.Initialize(45.f, { 0.f, 0.f, 0.f }, static_cast<float>(m_Width) / static_cast<float>(m_Height), 0.1f, 100.f);
-		m_Light.Initialize(m_pDevice, { 0.577f , -0.577f , 0.577f }, 7.0f);
+		LoadScene();
 	}
+#endif
 	Renderer::~Renderer()
 	{
 		for (auto& mesh : m_vMeshes)
@@ -65,6 +137,7 @@ namespace dae {
 			delete mesh.second;
 		}
 
+#if !defined(SOFTWARE_ONLY)
 		if (m_pRenderTargetView)		m_pRenderTargetView->Release();
 		if (m_pRenderTargetBuffer)		m_pRenderTargetBuffer->Release();
 		if (m_pDepthStencilView)		m_pDepthStencilView->Release();
@@ -81,8 +154,37 @@ namespace dae {
 		if (m_pRasterizerStateFront) m_pRasterizerStateFront->Release();
 		if (m_pRasterizerStateBack)  m_pRasterizerStateBack->Release();
 		if (m_pRasterizerStateNone)  m_pRasterizerStateNone->Release();
+#endif
 
+		if (m_pBackBuffer) SDL_FreeSurface(m_pBackBuffer);
+		delete[] m_pBackBufferPixels;
 		delete[] m_pDepthBufferPixels;
+		delete[] m_pVisibilityBufferPixels;
+	}
+	void Renderer::LoadScene()
+	{
+		// Initialize Meshes and Effects
+		m_vMeshes["0Vehicle"] = new Mesh(m_pDevice, "resources/vehicle.obj", "resources/Vehicle.fx", false);
+		m_vMeshes["0Vehicle"]->LoadDiffuseTexture("resources/vehicle_diffuse.png", m_pDevice);
+		m_vMeshes["0Vehicle"]->LoadNormalMap("resources/vehicle_normal.png", m_pDevice);
+		m_vMeshes["0Vehicle"]->LoadSpecularMap("resources/vehicle_specular.png", m_pDevice);
+		m_vMeshes["0Vehicle"]->LoadGlossinessMap("resources/vehicle_gloss.png", m_pDevice);
+		m_vMeshes["0Vehicle"]->PackMaterialTextures(true);
+		m_vMeshes["0Vehicle"]->SetWorldMatrix(Matrix::CreateTranslation(0.f, 0.f, 50.f));
+
+		m_vMeshes["1Fire"] = new Mesh(m_pDevice, "resources/fireFX.obj", "resources/Fire.fx", true);
+		m_vMeshes["1Fire"]->LoadDiffuseTexture("resources/fireFX_diffuse.png", m_pDevice);
+		m_vMeshes["1Fire"]->SetWorldMatrix(Matrix::CreateTranslation(0.f, 0.f, 50.f));
+
+
+		m_vMeshes["0Plane"] = new Mesh(m_pDevice, "resources/plane.obj", "resources/Plane.fx", false);
+		m_vMeshes["0Plane"]->LoadDiffuseTexture("resources/plane_diffuse.png", m_pDevice);
+		m_vMeshes["0Plane"]->SetWorldMatrix(Matrix::CreateTranslation(0.f, -10.f, 50.f));
+
+		// Initialize Camera
+		m_Camera.Initialize(45.f, { 0.f, 0.f, 0.f }, static_cast<float>(m_Width) / static_cast<float>(m_Height), 0.1f, 100.f);
+		m_Camera.CalculateViewMatrix();
+		m_Light.Initialize(m_pDevice, { 0.577f , -0.577f , 0.577f }, 7.0f);
 	}
 
 
@@ -92,20 +194,27 @@ namespace dae {
 	void Renderer::Update(const Timer* pTimer)
 	{
 		m_Camera.Update(pTimer);
+		Update(pTimer->GetElapsed());
+	}
+	void Renderer::Update(float elapsedSec)
+	{
 		m_Light.UpdateViewProjection({0,0,50});
 
+#if !defined(SOFTWARE_ONLY)
 		m_vMeshes["0Vehicle"]->GetEffect()->SetMatrixByName("gWorldMatrix", m_vMeshes["0Vehicle"]->GetWorldMatrix());
 		m_vMeshes["0Vehicle"]->GetEffect()->SetVector3ByName("gCameraPos", m_Camera.origin);
+#endif
 
 		if (m_RotateMesh)
 		{
 			constexpr float rotationSpeedRadians = 45 * TO_RADIANS;
-			m_vMeshes["0Vehicle"]->SetWorldMatrix(Matrix::CreateRotationY(pTimer->GetElapsed() * rotationSpeedRadians)
+			m_vMeshes["0Vehicle"]->SetWorldMatrix(Matrix::CreateRotationY(elapsedSec * rotationSpeedRadians)
 				* m_vMeshes["0Vehicle"]->GetWorldMatrix());
-			m_vMeshes["1Fire"]->SetWorldMatrix(Matrix::CreateRotationY(pTimer->GetElapsed() * rotationSpeedRadians)
+			m_vMeshes["1Fire"]->SetWorldMatrix(Matrix::CreateRotationY(elapsedSec * rotationSpeedRadians)
 				* m_vMeshes["1Fire"]->GetWorldMatrix());
 		}
 
+#if !defined(SOFTWARE_ONLY)
 		Matrix wvpMatrix = m_vMeshes["0Vehicle"]->GetWorldMatrix() * m_Camera.GetViewMatrix() * m_Camera.GetProjectionMatrix();
 		m_vMeshes["0Vehicle"]->GetEffect()->SetMatrixByName("gWorldViewProj", wvpMatrix);
 
@@ -118,7 +227,7 @@ namespace dae {
 
 		wvpMatrix = m_vMeshes["1Fire"]->GetWorldMatrix() * m_Camera.GetViewMatrix() * m_Camera.GetProjectionMatrix();
 		m_vMeshes["1Fire"]->GetEffect()->SetMatrixByName("gWorldViewProj", wvpMatrix);
-
+#endif
 	}
 	void Renderer::Render()
 	{
@@ -129,25 +238,22 @@ namespace dae {
 		if (m_SoftwareRasterizer)
 		{
 			// @START
-			SDL_FillRect(m_pBackBuffer, NULL, SDL_MapRGB(m_pBackBuffer->format,
-				static_cast<Uint8>(255 * fillColor.r),
-				static_cast<Uint8>(255 * fillColor.g),
-				static_cast<Uint8>(255 * fillColor.b)));
-			std::fill(&m_pDepthBufferPixels[0], &m_pDepthBufferPixels[m_Width * m_Height], 1);
-
-			// Lock BackBuffer
-			SDL_LockSurface(m_pBackBuffer);
+			ClearBuffers(fillColor);
 
 
 			RenderCPU();
 
 
 			// @END
-			SDL_UnlockSurface(m_pBackBuffer);
-			SDL_BlitSurface(m_pBackBuffer, 0, m_pFrontBuffer, 0);
-			SDL_UpdateWindowSurface(m_pWindow);
+			// The BackBuffer surface wraps our own pixels, SDL only gets to see them here
+			if (m_pWindow)
+			{
+				SDL_BlitSurface(m_pBackBuffer, 0, m_pFrontBuffer, 0);
+				SDL_UpdateWindowSurface(m_pWindow);
+			}
 
 		}
+#if !defined(SOFTWARE_ONLY)
 		else
 		{
 			// 1. CLEAR RTV & DSV
@@ -203,6 +309,12 @@ namespace dae {
 			// 5. PRESENT BACKBUFFER (SWAP)
 			m_pSwapChain->Present(0, 0);
 		}
+#endif
+	}
+
+	bool Renderer::SaveBufferToImage(const std::string& path) const
+	{
+		return SDL_SaveBMP(m_pBackBuffer, path.c_str()) == 0;
 	}
 
 
@@ -233,10 +345,52 @@ namespace dae {
 		}
 	}
 
+	void Renderer::CycleSamplingStates()
+	{
+		switch (m_CurrentSamplerState)
+		{
+		case SamplerState::Point:
+			SetSamplingState(SamplerState::Linear);
+			break;
+		case SamplerState::Linear:
+			SetSamplingState(SamplerState::Anisotropic);
+			break;
+		case SamplerState::Anisotropic:
+		default:
+			SetSamplingState(SamplerState::Point);
+			break;
+		}
+	}
+	void Renderer::SetSamplingState(SamplerState samplerState)
+	{
+		m_CurrentSamplerState = samplerState;
+		switch (m_CurrentSamplerState)
+		{
+		case SamplerState::Point:
+			std::cout << DARK_YELLOW_TXT << "**(SHARED) Sampler Filter = " << "POINT" << "\n";
+			break;
+		case SamplerState::Linear:
+			std::cout << DARK_YELLOW_TXT << "**(SHARED) Sampler Filter = " << "LINEAR" << "\n";
+			break;
+		case SamplerState::Anisotropic:
+			std::cout << DARK_YELLOW_TXT << "**(SHARED) Sampler Filter = " << "ANISOTROPIC" << "\n";
+			break;
+		}
+
+		// Both rasterizers sample with the state of the mesh
+		for (const auto& m : m_vMeshes)
+		{
+			m.second->SetTextureSamplingState(m_CurrentSamplerState);
+		}
+	}
 	void Renderer::ToggleRenderer()
 	{
+#if defined(SOFTWARE_ONLY)
+		std::cout << DARK_YELLOW_TXT << "**(SHARED) Rasterizer Mode = " << "SOFTWARE" << " (no GPU backend)\n";
+#else
 		m_SoftwareRasterizer = !m_SoftwareRasterizer;
 		std::cout << DARK_YELLOW_TXT << "**(SHARED) Rasterizer Mode = " << (m_SoftwareRasterizer ? "SOFTWARE" : "HARDWARE") << "\n";
+#endif
 	}
 	void Renderer::ToggleMeshRotation()
 	{
@@ -309,38 +463,66 @@ namespace dae {
 		m_DrawWireFrames = !m_DrawWireFrames;
 		std::cout << DARK_MAGENTA_TXT << "**(SOFTWARE) Wireframes Visualization = " << (m_DrawWireFrames ? "ON" : "OFF") << "\n";
 	}
+	void Renderer::ToggleTiledRasterization()
+	{
+		if (!m_SoftwareRasterizer) return;
+		m_TiledRasterization = !m_TiledRasterization;
+		std::cout << DARK_MAGENTA_TXT << "**(SOFTWARE) Tiled Multithreaded Rasterization = " << (m_TiledRasterization ? "ON" : "OFF") << "\n";
+	}
+	void Renderer::ToggleDeferredShading()
+	{
+		if (!m_SoftwareRasterizer) return;
+		m_DeferredShading = !m_DeferredShading;
+		std::cout << DARK_MAGENTA_TXT << "**(SOFTWARE) Deferred (Visibility Buffer) Shading = " << (m_DeferredShading ? "ON" : "OFF") << "\n";
+	}
+	void Renderer::ToggleTextureLayout()
+	{
+		if (!m_SoftwareRasterizer) return;
+		m_TextureLayout = m_TextureLayout == TextureLayout::Tiled ? TextureLayout::Linear : TextureLayout::Tiled;
+		std::cout << DARK_MAGENTA_TXT << "**(SOFTWARE) Texture Layout = " << (m_TextureLayout == TextureLayout::Tiled ? "TILED" : "LINEAR") << "\n";
 
-
-	//--------------------------------------------------
-	//    DirectX Rasterizer
-	//--------------------------------------------------
-	void Renderer::CycleSamplingStates()
+		// Only the memory order of the texels changes, the sampled colors stay the same
+		for (auto& mesh : m_vMeshes)
+			mesh.second->SetTextureLayout(m_TextureLayout);
+	}
+	void Renderer::ToggleLOD()
 	{
-		if (m_SoftwareRasterizer) return;
-		switch (m_CurrentSamplerState)
+		if (!m_SoftwareRasterizer) return;
+		m_LOD = !m_LOD;
+		std::cout << DARK_MAGENTA_TXT << "**(SOFTWARE) Mesh LODs = " << (m_LOD ? "ON" : "OFF") << "\n";
+	}
+	void Renderer::CompactMeshVertices()
+	{
+		size_t fullSize{};
+		size_t compactSize{};
+		for (auto& mesh : m_vMeshes)
 		{
-		case SamplerState::Point:
-			m_CurrentSamplerState = SamplerState::Linear;
-			std::cout << DARK_GREEN_TXT << "**(HARDWARE) Sampler Filter = " << "LINEAR" << "\n";
-			break;
-		case SamplerState::Linear:
-			m_CurrentSamplerState = SamplerState::Anisotropic;
-			std::cout << DARK_GREEN_TXT << "**(HARDWARE) Sampler Filter = " << "ANISOTROPIC" << "\n";
-			break;
-		case SamplerState::Anisotropic:
-			m_CurrentSamplerState = SamplerState::Point;
-			std::cout << DARK_GREEN_TXT << "**(HARDWARE) Sampler Filter = " << "POINT" << "\n";
-			break;
-		default:
-			m_CurrentSamplerState = SamplerState::Linear;
-			break;
+			fullSize += mesh.second->GetVertexMemorySize();
+			mesh.second->CompactVertices();
+			compactSize += mesh.second->GetVertexMemorySize();
 		}
-
-		for (const auto& m : m_vMeshes)
+		std::cout << DARK_MAGENTA_TXT << "**(SOFTWARE) Compact Vertices, " << fullSize / 1024 << " KB -> " << compactSize / 1024 << " KB\n";
+	}
+	void Renderer::ToggleSIMDRasterization()
+	{
+		if (!m_SoftwareRasterizer) return;
+#if defined(AVX2_KERNELS)
+		if (!m_SIMDSupported)
 		{
-			m.second->SetTextureSamplingState(m_CurrentSamplerState);
+			std::cout << DARK_MAGENTA_TXT << "**(SOFTWARE) SIMD (AVX2) Rasterization not supported by this CPU\n";
+			return;
 		}
+		m_SIMDRasterization = !m_SIMDRasterization;
+		std::cout << DARK_MAGENTA_TXT << "**(SOFTWARE) SIMD (AVX2) Rasterization = " << (m_SIMDRasterization ? "ON" : "OFF") << "\n";
+#else
+		std::cout << DARK_MAGENTA_TXT << "**(SOFTWARE) SIMD (AVX2) Rasterization not available in this build\n";
+#endif
 	}
+
+
+	//--------------------------------------------------
+	//    DirectX Rasterizer
+	//--------------------------------------------------
 	void Renderer::ToggleShadows()
 	{
 		if (m_SoftwareRasterizer) return;
@@ -354,214 +536,738 @@ namespace dae {
 	//--------------------------------------------------
 	void Renderer::RenderCPU()
 	{
-		// predefine a triangle we can reuse
-		std::array<VertexOut, 3> triangleNDC{};
-		std::array<VertexOut, 3> triangleRasterVertices{};
+		// Triangles are set up once here and only rasterized after all meshes are done
+		m_vTriangles.clear();
+		m_ShadedPixelCount = 0;
+		m_DepthPassCount = 0;
+		m_LODTriangleCount = 0;
+		m_LODSavedTriangleCount = 0;
 
 		for (auto& element : m_vMeshes)
 		{
 			Mesh* currentMesh = element.second;
 			if (!m_FireVisible and currentMesh->HasTransparency()) continue;
+			// Same as the hardware rasterizer, the plane is only there to receive the shadows
+			if (!m_Shadows and element.first == "0Plane") continue;
 
-			auto& verticesOut = currentMesh->GetVerticesOutByReference();
-			auto& vertices = currentMesh->GetVerticesByReference();
-			auto& indices = currentMesh->GetIndicesByReference();
-			auto& worldMatrix = currentMesh->GetWorldMatrix();
-			auto primitiveTopology = currentMesh->GetPrimitiveTopology();
+			SelectLOD(currentMesh);
+			const size_t lodTriangleCount = currentMesh->GetLODTriangleCount(currentMesh->GetCurrentLOD());
+			m_LODTriangleCount += lodTriangleCount;
+			m_LODSavedTriangleCount += currentMesh->GetLODTriangleCount(0) - lodTriangleCount;
 
-			int indexJump = 0;
-			int triangleCount = 0;
-			bool triangleStripMethod = false;
+			// Project the entire mesh to clip and screen space coordinates, every vertex exactly once
+			ProjectMeshToNDC(currentMesh);
 
-			// Determine the triangle count and index jump depending on the PrimitiveTopology
-			if (primitiveTopology == PrimitiveTopology::TriangleList)
+			// The pipeline variants are picked once per draw, from here on the render state is known at compile time
+			// Triangles that could not be baked to object space normals keep the tangent space variant
+			(this->*m_ASSEMBLE_FUNCTIONS[SelectSetupPipeline(currentMesh)])(currentMesh,
+				SelectPixelPipeline(currentMesh, currentMesh->HasObjectSpaceNormals()), SelectPixelPipeline(currentMesh, false));
+		}
+
+		if (m_TiledRasterization)
+		{
+			RasterizeTiles();
+		}
+		else
+		{
+			for (const TriangleSetup& triangle : m_vTriangles)
+			{
+				// Deferred: transparent triangles are blended on top of the resolved image, in the same order as before
+				if (m_DeferredShading and triangle.pMesh->HasTransparency()) continue;
+				RasterizeTriangle(triangle, { 0, 0 }, { m_Width, m_Height });
+			}
+
+			if (m_DeferredShading)
 			{
-				indexJump = 3;
-				triangleCount = static_cast<int>(indices.size()) / 3;
-				triangleStripMethod = false;
+				ResolveVisibility({ 0, 0 }, { m_Width, m_Height });
+				for (const TriangleSetup& triangle : m_vTriangles)
+				{
+					if (triangle.pMesh->HasTransparency()) RasterizeTriangle(triangle, { 0, 0 }, { m_Width, m_Height });
+				}
 			}
-			else if (primitiveTopology == PrimitiveTopology::TriangleStrip)
+		}
+	}
+	template<SetupPipeline Pipeline>
+	void Renderer::AssembleTriangles(Mesh* currentMesh, uint8_t pixelPipeline, uint8_t tangentSpacePipeline)
+	{
+		// Compact meshes have 16 bit indices when they fit
+		const int lod = currentMesh->GetCurrentLOD();
+		if (lod > 0)
+		{
+			const MeshLOD& meshLOD = currentMesh->GetLOD(lod);
+			if (currentMesh->HasShortIndices())
+				AssembleIndexedTriangles<Pipeline>(currentMesh, meshLOD.shortIndices, meshLOD.sourceTriangles.data(), pixelPipeline, tangentSpacePipeline);
+			else
+				AssembleIndexedTriangles<Pipeline>(currentMesh, meshLOD.indices, meshLOD.sourceTriangles.data(), pixelPipeline, tangentSpacePipeline);
+		}
+		else if (currentMesh->HasShortIndices())
+			AssembleIndexedTriangles<Pipeline>(currentMesh, currentMesh->GetShortIndicesByReference(), nullptr, pixelPipeline, tangentSpacePipeline);
+		else
+			AssembleIndexedTriangles<Pipeline>(currentMesh, currentMesh->GetIndicesByReference(), nullptr, pixelPipeline, tangentSpacePipeline);
+	}
+	template<SetupPipeline Pipeline, typename IndexType>
+	void Renderer::AssembleIndexedTriangles(Mesh* currentMesh, const std::vector<IndexType>& indices, const uint32_t* pSourceTriangles, uint8_t pixelPipeline, uint8_t tangentSpacePipeline)
+	{
+		// predefine a triangle we can reuse
+		std::array<VertexOut, 3> triangleRasterVertices{};
+
+		auto& verticesOut = currentMesh->GetVerticesOutByReference();
+		auto& verticesScreen = currentMesh->GetVerticesScreenByReference();
+		auto& clipFlags = currentMesh->GetClipFlagsByReference();
+		auto primitiveTopology = currentMesh->GetPrimitiveTopology();
+
+		int indexJump = 0;
+		int triangleCount = 0;
+		bool triangleStripMethod = false;
+
+		// Determine the triangle count and index jump depending on the PrimitiveTopology
+		if (primitiveTopology == PrimitiveTopology::TriangleList)
+		{
+			indexJump = 3;
+			triangleCount = static_cast<int>(indices.size()) / 3;
+			triangleStripMethod = false;
+		}
+		else if (primitiveTopology == PrimitiveTopology::TriangleStrip)
+		{
+			indexJump = 1;
+			triangleCount = static_cast<int>(indices.size()) - 2;
+			triangleStripMethod = true;
+		}
+
+		// Loop over all the triangles
+		for (int triangleIndex{}; triangleIndex < triangleCount; ++triangleIndex)
+		{
+			uint32_t indexPos0 = indices[indexJump * triangleIndex + 0];
+			uint32_t indexPos1 = indices[indexJump * triangleIndex + 1];
+			uint32_t indexPos2 = indices[indexJump * triangleIndex + 2];
+			// Skip if duplicate indices
+			if (indexPos0 == indexPos1 or indexPos0 == indexPos2 or indexPos1 == indexPos2) continue;
+			// If the triangle strip method is in use, swap the indices of odd indexed triangles
+			if (triangleStripMethod and (triangleIndex & 1)) std::swap(indexPos1, indexPos2);
+
+			// Completely outside one of the clip planes
+			const uint8_t clipFlags0 = clipFlags[indexPos0];
+			const uint8_t clipFlags1 = clipFlags[indexPos1];
+			const uint8_t clipFlags2 = clipFlags[indexPos2];
+			if (clipFlags0 & clipFlags1 & clipFlags2) continue;
+
+			// LOD triangles have the per-triangle state of the full detail triangle they are left of
+			const int sourceTriangle = pSourceTriangles ? static_cast<int>(pSourceTriangles[triangleIndex]) : triangleIndex;
+			const uint8_t trianglePipeline = currentMesh->IsTangentSpaceTriangle(sourceTriangle) ? tangentSpacePipeline : pixelPipeline;
+
+			// Only triangles crossing the near/far plane or leaving the guard band need clipping,
+			// the part of the others outside the screen is taken care of by the bounding box clamp
+			if (clipFlags0 | clipFlags1 | clipFlags2)
 			{
-				indexJump = 1;
-				triangleCount = static_cast<int>(indices.size()) - 2;
-				triangleStripMethod = true;
+				ClipTriangle<Pipeline>({ verticesOut[indexPos0], verticesOut[indexPos1], verticesOut[indexPos2] }, clipFlags0 | clipFlags1 | clipFlags2, currentMesh, trianglePipeline);
+				continue;
 			}
 
-			// Project the entire mesh to NDC coordinates
-			ProjectMeshToNDC(currentMesh);
+			// Gather the triangle in RasterSpace
+			triangleRasterVertices[0] = verticesScreen[indexPos0];
+			triangleRasterVertices[1] = verticesScreen[indexPos1];
+			triangleRasterVertices[2] = verticesScreen[indexPos2];
+			SetupTriangle<Pipeline>(triangleRasterVertices, currentMesh, trianglePipeline);
+		}
+	}
+	template<SetupPipeline Pipeline>
+	void Renderer::SetupTriangle(const std::array<VertexOut, 3>& triangleRasterVertices, Mesh* currentMesh, uint8_t pixelPipeline)
+	{
+		// Calculate the minimum depth if the current triangle, which we will use later for early-depth test
+		const float minDepth = std::min({ triangleRasterVertices[0].position.z, triangleRasterVertices[1].position.z, triangleRasterVertices[2].position.z });
+
+		const Vector2& v0 = triangleRasterVertices[0].position.GetXY();
+		const Vector2& v1 = triangleRasterVertices[1].position.GetXY();
+		const Vector2& v2 = triangleRasterVertices[2].position.GetXY();
 
-			// Loop over all the triangles
-			for (int triangleIndex{}; triangleIndex < triangleCount; ++triangleIndex)
+		if constexpr (Pipeline.wireFrame)
+		{
+			ColorRGB wireFrameColor = colors::White * Remap01(minDepth, 0.998f, 1.f);
+
+			DrawLine(int(v0.x), int(v0.y), int(v1.x), int(v1.y), wireFrameColor);
+			DrawLine(int(v1.x), int(v1.y), int(v2.x), int(v2.y), wireFrameColor);
+			DrawLine(int(v2.x), int(v2.y), int(v0.x), int(v0.y), wireFrameColor);
+
+			return;
+		}
+
+		// Snap the vertices to the fixed point sub-pixel grid, from here on the edge functions are exact
+		const Int2 p0 = ToFixedPoint(v0);
+		const Int2 p1 = ToFixedPoint(v1);
+		const Int2 p2 = ToFixedPoint(v2);
+
+		// Edge i is the edge opposite to vertex i, so it gives the barycentric weight of that vertex
+		std::array<EdgeFunction, 3> edges{ CreateEdgeFunction(p1, p2), CreateEdgeFunction(p2, p0), CreateEdgeFunction(p0, p1) };
+		// Any edge function evaluated at its opposite vertex is the (doubled) area of the triangle
+		const int64_t area = EvaluateEdgeFunction(edges[0], p0);
+		// Cull (transparent meshes like fire always use CullMode::None)
+		if constexpr (Pipeline.cullMode == CullMode::BackFace)	{ if (area < 0) return; }
+		if constexpr (Pipeline.cullMode == CullMode::FrontFace)	{ if (area > 0) return; }
+		if (area == 0) return; // degenerate triangle, covers no pixels
+
+		for (EdgeFunction& edge : edges)
+		{
+			// Make the inside of the triangle positive, whatever the winding order
+			if (area < 0) edge = { -edge.a, -edge.b, -edge.c };
+
+			// Top-left fill rule: a pixel center exactly on an edge only belongs to the triangle if it is a top or left edge,
+			// so a pixel on an edge shared by two triangles is always shaded exactly once
+			if (!IsTopLeftEdge(edge)) edge.c -= 1;
+		}
+		// Pre-calculate the inverse area of the triangle, so the barycentric coordinates only need a multiply per pixel
+		const float invArea = 1.f / static_cast<float>(std::abs(area));
+
+
+		// Define the triangle's bounding box
+		Vector2 min = { FLT_MAX,  FLT_MAX };
+		Vector2 max = { -FLT_MAX, -FLT_MAX };
+		{
+			// Minimums
+			min = Vector2::Min(min, v0);
+			min = Vector2::Min(min, v1);
+			min = Vector2::Min(min, v2);
+			// Clamp between screen min and max, but also make sure that, due to floating point -> int rounding happens correct
+			min.x = std::clamp(std::floor(min.x), 0.f, m_Width - 1.f);
+			min.y = std::clamp(std::floor(min.y), 0.f, m_Height - 1.f);
+
+			// Maximums
+			max = Vector2::Max(max, v0);
+			max = Vector2::Max(max, v1);
+			max = Vector2::Max(max, v2);
+			// Clamp between screen min and max (exclusive), but also make sure that, due to floating point -> int rounding happens correct
+			max.x = std::clamp(std::ceil(max.x), 0.f, static_cast<float>(m_Width));
+			max.y = std::clamp(std::ceil(max.y), 0.f, static_cast<float>(m_Height));
+		}
+
+		if constexpr (Pipeline.boundingBoxes)
+		{
+			DrawBoundingBoxes(min, max);
+			return;
+		}
+
+		// Store the set up triangle, the debug views above already drew theirs
+		TriangleSetup& triangle = m_vTriangles.emplace_back();
+		triangle.vertices = triangleRasterVertices;
+		triangle.edges = edges;
+		triangle.min = { int(min.x), int(min.y) };
+		triangle.max = { int(max.x), int(max.y) };
+		triangle.minDepth = minDepth;
+		triangle.invArea = invArea;
+		triangle.pMesh = currentMesh;
+		triangle.pipeline = pixelPipeline;
+		SetupAttributePlanes(triangle);
+	}
+	template<SetupPipeline Pipeline>
+	void Renderer::ClipTriangle(const std::array<VertexOut, 3>& triangleClip, uint8_t clipFlags, Mesh* currentMesh, uint8_t pixelPipeline)
+	{
+		// Sutherland-Hodgman in CLIP SPACE, only against the planes the triangle actually crosses.
+		// Every plane can add at most one vertex to the polygon
+		constexpr int MAX_POLYGON_VERTICES{ 3 + CLIP_PLANE_COUNT };
+		std::array<VertexOut, MAX_POLYGON_VERTICES> polygon{ triangleClip[0], triangleClip[1], triangleClip[2] };
+		std::array<VertexOut, MAX_POLYGON_VERTICES> clipped{};
+		int vertexCount{ 3 };
+
+		for (int planeIndex{}; planeIndex < CLIP_PLANE_COUNT; ++planeIndex)
+		{
+			if (!(clipFlags & (1 << planeIndex))) continue;
+
+			int clippedCount{};
+			for (int index{}; index < vertexCount; ++index)
 			{
-				uint32_t indexPos0 = indices[indexJump * triangleIndex + 0];
-				uint32_t indexPos1 = indices[indexJump * triangleIndex + 1];
-				uint32_t indexPos2 = indices[indexJump * triangleIndex + 2];
-				// Skip if duplicate indices
-				if (indexPos0 == indexPos1 or indexPos0 == indexPos2 or indexPos1 == indexPos2) continue;
-				// If the triangle strip method is in use, swap the indices of odd indexed triangles
-				if (triangleStripMethod and (triangleIndex & 1)) std::swap(indexPos1, indexPos2);
-
-				// Define triangle in NDC
-				triangleNDC[0] = verticesOut[indexPos0];
-				triangleNDC[1] = verticesOut[indexPos1];
-				triangleNDC[2] = verticesOut[indexPos2];
-				// Calculate the minimum depth if the current triangle, which we will use later for early-depth test
-				const float minDepth = std::min({ triangleNDC[0].position.z, triangleNDC[1].position.z, triangleNDC[2].position.z });
-
-				// Cull the triangle if one or more of the NDC vertices are outside the frustum
-				if (!IsNDCTriangleInFrustum(triangleNDC[0])) continue;
-				if (!IsNDCTriangleInFrustum(triangleNDC[1])) continue;
-				if (!IsNDCTriangleInFrustum(triangleNDC[2])) continue;
-
-				// Rasterize the vertices
-				RasterizeVertex(verticesOut[indexPos0]);
-				RasterizeVertex(verticesOut[indexPos1]);
-				RasterizeVertex(verticesOut[indexPos2]);
-
-				// Define triangle in RasterSpace
-				triangleRasterVertices[0] = verticesOut[indexPos0];
-				triangleRasterVertices[1] = verticesOut[indexPos1];
-				triangleRasterVertices[2] = verticesOut[indexPos2];
-				const Vector2& v0 = triangleRasterVertices[0].position.GetXY();
-				const Vector2& v1 = triangleRasterVertices[1].position.GetXY();
-				const Vector2& v2 = triangleRasterVertices[2].position.GetXY();
-
-				if (m_DrawWireFrames)
+				const VertexOut& current = polygon[index];
+				const VertexOut& next = polygon[(index + 1) % vertexCount];
+				const float currentDistance = ClipPlaneDistance(current.position, planeIndex);
+				const float nextDistance = ClipPlaneDistance(next.position, planeIndex);
+
+				if (currentDistance >= 0) clipped[clippedCount++] = current;
+				// The edge crosses the plane, add the intersection
+				if ((currentDistance >= 0) != (nextDistance >= 0))
+					clipped[clippedCount++] = LerpVertex(current, next, currentDistance / (currentDistance - nextDistance));
+			}
+
+			std::swap(polygon, clipped);
+			vertexCount = clippedCount;
+			if (vertexCount < 3) return;
+		}
+
+		// Perspective divide the polygon once, then set it up as a fan (keeping the winding order of the original triangle)
+		for (int index{}; index < vertexCount; ++index)
+			ClipToScreen(polygon[index]);
+
+		for (int index{ 1 }; index + 1 < vertexCount; ++index)
+			SetupTriangle<Pipeline>({ polygon[0], polygon[index], polygon[index + 1] }, currentMesh, pixelPipeline);
+	}
+	void Renderer::RasterizeTiles()
+	{
+		// Bin every triangle into all the tiles its bounding box overlaps.
+		// Triangles are added in submission order, so every tile still draws them in the same order as the single threaded path
+		for (auto& bin : m_vTileBins)
+			bin.clear();
+
+		for (uint32_t triangleIndex{}; triangleIndex < m_vTriangles.size(); ++triangleIndex)
+		{
+			const TriangleSetup& triangle = m_vTriangles[triangleIndex];
+			if (triangle.min.x >= triangle.max.x or triangle.min.y >= triangle.max.y) continue; // covers no pixels
+
+			const int tileMinX = triangle.min.x / m_TILE_SIZE;
+			const int tileMinY = triangle.min.y / m_TILE_SIZE;
+			const int tileMaxX = (triangle.max.x - 1) / m_TILE_SIZE;
+			const int tileMaxY = (triangle.max.y - 1) / m_TILE_SIZE;
+
+			for (int tileY{ tileMinY }; tileY <= tileMaxY; ++tileY)
+			{
+				for (int tileX{ tileMinX }; tileX <= tileMaxX; ++tileX)
 				{
-					ColorRGB wireFrameColor = colors::White * Remap01(minDepth, 0.998f, 1.f);
+					m_vTileBins[m_TileCountX * tileY + tileX].push_back(triangleIndex);
+				}
+			}
+		}
 
-					DrawLine(int(v0.x), int(v0.y), int(v1.x), int(v1.y), wireFrameColor);
-					DrawLine(int(v1.x), int(v1.y), int(v2.x), int(v2.y), wireFrameColor);
-					DrawLine(int(v2.x), int(v2.y), int(v0.x), int(v0.y), wireFrameColor);
+		// Rasterize and shade the tiles in parallel.
+		// A tile only touches its own part of the color and depth buffer, which stays in cache while all its triangles are drawn
+		std::for_each(std::execution::par, m_vTileIndices.begin(), m_vTileIndices.end(), [this](int tileIndex)
+			{
+				const Int2 tileMin{ (tileIndex % m_TileCountX) * m_TILE_SIZE, (tileIndex / m_TileCountX) * m_TILE_SIZE };
+				const Int2 tileMax{ std::min(tileMin.x + m_TILE_SIZE, m_Width), std::min(tileMin.y + m_TILE_SIZE, m_Height) };
 
-					continue;
+				for (const uint32_t triangleIndex : m_vTileBins[tileIndex])
+				{
+					if (m_DeferredShading and m_vTriangles[triangleIndex].pMesh->HasTransparency()) continue;
+					RasterizeTriangle(m_vTriangles[triangleIndex], tileMin, tileMax);
 				}
 
-				// Pre-calculate the inverse area of the triangle so this doesn't need to happen for
-				// every pixel once we calculate the barycentric coordinates (as the triangle area won't change)
-				float area = Vector2::Cross(v1 - v0, v2 - v0);
-				// Cull (except for transparent meshes like fire)
-				if ((area < 0 and m_CurrentCullMode == CullMode::BackFace || area > 0 and m_CurrentCullMode == CullMode::FrontFace)
-					&& !currentMesh->HasTransparency()) continue;
-				if (area <= FLT_EPSILON and area >= -FLT_EPSILON) continue; // area is 0, we don't want zero-division
-				float invArea = 1.f / area;
+				if (m_DeferredShading)
+				{
+					ResolveVisibility(tileMin, tileMax);
+					for (const uint32_t triangleIndex : m_vTileBins[tileIndex])
+					{
+						if (m_vTriangles[triangleIndex].pMesh->HasTransparency()) RasterizeTriangle(m_vTriangles[triangleIndex], tileMin, tileMax);
+					}
+				}
+			});
+	}
+	void Renderer::RasterizeTriangle(const TriangleSetup& triangle, const Int2& clipMin, const Int2& clipMax)
+	{
+		(this->*m_RASTERIZE_FUNCTIONS[triangle.pipeline])(triangle, clipMin, clipMax);
+	}
+	template<PixelPipeline Pipeline>
+	void Renderer::RasterizeTriangle(const TriangleSetup& triangle, const Int2& clipMin, const Int2& clipMax)
+	{
+		// Only the part of the bounding box inside the clip rectangle (the whole screen or a single tile)
+		const Int2 min{ std::max(triangle.min.x, clipMin.x), std::max(triangle.min.y, clipMin.y) };
+		const Int2 max{ std::min(triangle.max.x, clipMax.x), std::min(triangle.max.y, clipMax.y) };
+		if (min.x >= max.x or min.y >= max.y) return;
+
+		// Opaque triangles only write their ID to the visibility buffer in deferred mode, everything else is shaded right away
+		const uint32_t triangleIndex = static_cast<uint32_t>(&triangle - m_vTriangles.data());
+		constexpr bool writeDepth = !Pipeline.transparent;
+		const bool deferShading = m_DeferredShading and writeDepth;
+		uint64_t passedPixels{};
+
+		// Walk the bounding box block by block, blocks never cross a tile so every tile only touches its own part of the HiZ buffer
+		const int blockMinX = min.x / m_HIZ_BLOCK_SIZE;
+		const int blockMinY = min.y / m_HIZ_BLOCK_SIZE;
+		const int blockMaxX = (max.x - 1) / m_HIZ_BLOCK_SIZE;
+		const int blockMaxY = (max.y - 1) / m_HIZ_BLOCK_SIZE;
+
+		for (int blockY{ blockMinY }; blockY <= blockMaxY; ++blockY)
+		{
+			for (int blockX{ blockMinX }; blockX <= blockMaxX; ++blockX)
+			{
+				// Coarse depth test: if the triangle is further away than the furthest depth in the block,
+				// every pixel would fail the early depth test, so the whole block can be skipped without touching the depth buffer
+				float& blockMaxDepth = m_vHiZBuffer[m_HiZCountX * blockY + blockX];
+				if (triangle.minDepth > blockMaxDepth) continue;
+
+				const Int2 blockMin{ std::max(min.x, blockX * m_HIZ_BLOCK_SIZE), std::max(min.y, blockY * m_HIZ_BLOCK_SIZE) };
+				const Int2 blockMax{ std::min(max.x, (blockX + 1) * m_HIZ_BLOCK_SIZE), std::min(max.y, (blockY + 1) * m_HIZ_BLOCK_SIZE) };
+
+#if defined(AVX2_KERNELS)
+				const int blockPixels = m_SIMDRasterization ? RasterizeBlockSIMD<Pipeline>(triangle, triangleIndex, blockMin, blockMax) : RasterizeBlock<Pipeline>(triangle, triangleIndex, blockMin, blockMax);
+#else
+				const int blockPixels = RasterizeBlock<Pipeline>(triangle, triangleIndex, blockMin, blockMax);
+#endif
+				// Depths only get closer, so the block max only has to be recalculated when something was written
+				if (blockPixels > 0 and writeDepth) blockMaxDepth = CalculateBlockMaxDepth(blockX, blockY);
+				passedPixels += blockPixels;
+			}
+		}
 
+		// One update per triangle (and tile), instead of contending on the counters for every pixel
+		m_DepthPassCount += passedPixels;
+		if (!deferShading) m_ShadedPixelCount += passedPixels;
+	}
+	template<PixelPipeline Pipeline>
+	int Renderer::RasterizeBlock(const TriangleSetup& triangle, uint32_t triangleIndex, const Int2& min, const Int2& max)
+	{
+		const std::array<VertexOut, 3>& triangleRasterVertices = triangle.vertices;
+		const float minDepth = triangle.minDepth;
+		const float invArea = triangle.invArea;
+		constexpr bool writeDepth = !Pipeline.transparent;
+		const bool deferShading = m_DeferredShading and writeDepth;
+		int passedPixels{};
+
+		// Evaluate the edge functions once, at the center of the first pixel
+		const EdgeFunction& e0 = triangle.edges[0];
+		const EdgeFunction& e1 = triangle.edges[1];
+		const EdgeFunction& e2 = triangle.edges[2];
+		const Int2 start{ (min.x << SUBPIXEL_BITS) + SUBPIXEL_HALF, (min.y << SUBPIXEL_BITS) + SUBPIXEL_HALF };
+		int64_t row0 = EvaluateEdgeFunction(e0, start);
+		int64_t row1 = EvaluateEdgeFunction(e1, start);
+		int64_t row2 = EvaluateEdgeFunction(e2, start);
+
+		// From there on, moving one pixel just adds A (horizontally) or B (vertically)
+		const int64_t stepX0 = e0.a * SUBPIXEL_ONE, stepY0 = e0.b * SUBPIXEL_ONE;
+		const int64_t stepX1 = e1.a * SUBPIXEL_ONE, stepY1 = e1.b * SUBPIXEL_ONE;
+		const int64_t stepX2 = e2.a * SUBPIXEL_ONE, stepY2 = e2.b * SUBPIXEL_ONE;
+
+		// For every pixel (within the bounding box)
+		for (int py{ min.y }; py < max.y; ++py, row0 += stepY0, row1 += stepY1, row2 += stepY2)
+		{
+			int64_t w0 = row0;
+			int64_t w1 = row1;
+			int64_t w2 = row2;
+			for (int px{ min.x }; px < max.x; ++px, w0 += stepX0, w1 += stepX1, w2 += stepX2)
+			{
+				// The pixel center is outside the triangle as soon as one of the edge functions is negative
+				if ((w0 | w1 | w2) < 0) continue;
+
+				// Do an early depth test!!
+				// If the minimum depth of our triangle is already bigger than what is stored in the depth buffer (at a current pixel),
+				// there is no chance that that pixel inside the triangle will be closer, so we just skip to the next pixel
+				if (minDepth > m_pDepthBufferPixels[m_Width * py + px]) continue;
+
+				// Declare wInterpolated and zBufferValue of this pixel
+				float wInterpolated{ FLT_MAX };
+				float zBufferValue{ FLT_MAX };
+
+				// The barycentric coordinates of that pixel are the edge functions, normalized by the triangle area
+				const Vector3 barycentricCoords{ static_cast<float>(w0) * invArea, static_cast<float>(w1) * invArea, static_cast<float>(w2) * invArea };
+
+				// Now we interpolated both our Z and W depths
+				InterpolateDepths(zBufferValue, wInterpolated, triangleRasterVertices, barycentricCoords);
+				if (zBufferValue < 0 or zBufferValue > 1) continue; // if z-depth is outside of frustum, skip to next pixel
+				if (wInterpolated < 0) continue; // if w-depth is negative (behind camera), skip to next pixel
 
-				// Define the triangle's bounding box
-				Vector2 min = { FLT_MAX,  FLT_MAX };
-				Vector2 max = { -FLT_MAX, -FLT_MAX };
+				// If out current value in the zBuffer is smaller than our new one, skip to the next pixel
+				if (zBufferValue > m_pDepthBufferPixels[m_Width * py + px]) continue;
+
+				// Now that we are sure our z-depth is smaller than the one in the zBuffer, we can update the zBuffer and interpolate the attributes
+				// We only want to do this if there is no transparency
+				if constexpr (writeDepth)
 				{
-					// Minimums
-					min = Vector2::Min(min, v0);
-					min = Vector2::Min(min, v1);
-					min = Vector2::Min(min, v2);
-					// Clamp between screen min and max, but also make sure that, due to floating point -> int rounding happens correct
-					min.x = std::clamp(std::floor(min.x), 0.f, m_Width - 1.f);
-					min.y = std::clamp(std::floor(min.y), 0.f, m_Height - 1.f);
-
-					// Maximums
-					max = Vector2::Max(max, v0);
-					max = Vector2::Max(max, v1);
-					max = Vector2::Max(max, v2);
-					// Clamp between screen min and max, but also make sure that, due to floating point -> int rounding happens correct
-					max.x = std::clamp(std::ceil(max.x), 0.f, m_Width - 1.f);
-					max.y = std::clamp(std::ceil(max.y), 0.f, m_Height - 1.f);
+					m_pDepthBufferPixels[m_Width * py + px] = zBufferValue;
 				}
+				++passedPixels;
 
-				if (m_BoundingBoxVisualization)
+				// Deferred: only remember which triangle is visible, it is shaded once all triangles are rasterized
+				if (deferShading)	m_pVisibilityBufferPixels[m_Width * py + px] = triangleIndex;
+				else				m_pBackBufferPixels[m_Width * py + px] = PackColor(ShadePixel<Pipeline>(triangle, px, py, barycentricCoords, zBufferValue, wInterpolated));
+			}
+		}
+		return passedPixels;
+	}
+#if defined(AVX2_KERNELS)
+	template<PixelPipeline Pipeline>
+	AVX2_TARGET int Renderer::RasterizeBlockSIMD(const TriangleSetup& triangle, uint32_t triangleIndex, const Int2& min, const Int2& max)
+	{
+		// Same tests as the scalar loop, for 8 horizontally adjacent pixels at once.
+		// Only the pixels that pass coverage and depth are shaded (still one by one), so both paths give the exact same image
+		constexpr int LANES{ 8 };
+
+		const std::array<VertexOut, 3>& v = triangle.vertices;
+		constexpr bool writeDepth = !Pipeline.transparent;
+		const bool deferShading = m_DeferredShading and writeDepth;
+		const __m256i triangleIndices = _mm256_set1_epi32(static_cast<int>(triangleIndex));
+		int passedPixels{};
+
+		const EdgeFunction& e0 = triangle.edges[0];
+		const EdgeFunction& e1 = triangle.edges[1];
+		const EdgeFunction& e2 = triangle.edges[2];
+		const Int2 start{ (min.x << SUBPIXEL_BITS) + SUBPIXEL_HALF, (min.y << SUBPIXEL_BITS) + SUBPIXEL_HALF };
+		int64_t row0 = EvaluateEdgeFunction(e0, start);
+		int64_t row1 = EvaluateEdgeFunction(e1, start);
+		int64_t row2 = EvaluateEdgeFunction(e2, start);
+
+		const int64_t stepX0 = e0.a * SUBPIXEL_ONE, stepY0 = e0.b * SUBPIXEL_ONE;
+		const int64_t stepX1 = e1.a * SUBPIXEL_ONE, stepY1 = e1.b * SUBPIXEL_ONE;
+		const int64_t stepX2 = e2.a * SUBPIXEL_ONE, stepY2 = e2.b * SUBPIXEL_ONE;
+
+		// The edge functions need 64 bits, so the 8 lanes are split into two registers of 4 (pixels 0-3 and 4-7),
+		// each lane starting at its own offset from the first pixel of the block
+		const __m256i offsetLo0 = _mm256_setr_epi64x(0, stepX0, 2 * stepX0, 3 * stepX0);
+		const __m256i offsetLo1 = _mm256_setr_epi64x(0, stepX1, 2 * stepX1, 3 * stepX1);
+		const __m256i offsetLo2 = _mm256_setr_epi64x(0, stepX2, 2 * stepX2, 3 * stepX2);
+		const __m256i offsetHi0 = _mm256_add_epi64(offsetLo0, _mm256_set1_epi64x(4 * stepX0));
+		const __m256i offsetHi1 = _mm256_add_epi64(offsetLo1, _mm256_set1_epi64x(4 * stepX1));
+		const __m256i offsetHi2 = _mm256_add_epi64(offsetLo2, _mm256_set1_epi64x(4 * stepX2));
+		const __m256i blockStep0 = _mm256_set1_epi64x(LANES * stepX0);
+		const __m256i blockStep1 = _mm256_set1_epi64x(LANES * stepX1);
+		const __m256i blockStep2 = _mm256_set1_epi64x(LANES * stepX2);
+
+		// AVX2 has no int64 -> float conversion. As long as a value stays within +-2^51 (the edge functions of on screen triangles
+		// are far below that) adding it to the bits of 1.5 * 2^52 gives a double that is exactly that value + 1.5 * 2^52
+		const __m256d magic = _mm256_set1_pd(6755399441055744.0);
+		const __m256i magicBits = _mm256_castpd_si256(magic);
+		const auto toFloat = [&](const __m256i& lo, const __m256i& hi) AVX2_TARGET
+			{
+				const __m256d lod = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_add_epi64(lo, magicBits)), magic);
+				const __m256d hid = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_add_epi64(hi, magicBits)), magic);
+				return _mm256_set_m128(_mm256_cvtpd_ps(hid), _mm256_cvtpd_ps(lod));
+			};
+
+		const __m256 invArea = _mm256_set1_ps(triangle.invArea);
+		const __m256 minDepth = _mm256_set1_ps(triangle.minDepth);
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 one = _mm256_set1_ps(1.f);
+		const __m256 Z0 = _mm256_set1_ps(v[0].position.z), Z1 = _mm256_set1_ps(v[1].position.z), Z2 = _mm256_set1_ps(v[2].position.z);
+		const __m256 W0 = _mm256_set1_ps(v[0].position.w), W1 = _mm256_set1_ps(v[1].position.w), W2 = _mm256_set1_ps(v[2].position.w);
+		// Same operation order as InterpolateDepth, so the depths match the scalar path bit for bit
+		const __m256 numeratorZ = _mm256_mul_ps(_mm256_mul_ps(Z0, Z1), Z2);
+		const __m256 numeratorW = _mm256_mul_ps(_mm256_mul_ps(W0, W1), W2);
+
+		// Bit i of a mask -> all ones in lane i
+		const __m256i laneBits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+
+		alignas(32) float b0Lanes[LANES]{}, b1Lanes[LANES]{}, b2Lanes[LANES]{};
+		alignas(32) float zLanes[LANES]{}, wLanes[LANES]{};
+		alignas(32) float rLanes[LANES]{}, gLanes[LANES]{}, bLanes[LANES]{};
+
+		for (int py{ min.y }; py < max.y; ++py, row0 += stepY0, row1 += stepY1, row2 += stepY2)
+		{
+			__m256i w0Lo = _mm256_add_epi64(_mm256_set1_epi64x(row0), offsetLo0), w0Hi = _mm256_add_epi64(_mm256_set1_epi64x(row0), offsetHi0);
+			__m256i w1Lo = _mm256_add_epi64(_mm256_set1_epi64x(row1), offsetLo1), w1Hi = _mm256_add_epi64(_mm256_set1_epi64x(row1), offsetHi1);
+			__m256i w2Lo = _mm256_add_epi64(_mm256_set1_epi64x(row2), offsetLo2), w2Hi = _mm256_add_epi64(_mm256_set1_epi64x(row2), offsetHi2);
+
+			for (int px{ min.x }; px < max.x; px += LANES,
+				w0Lo = _mm256_add_epi64(w0Lo, blockStep0), w0Hi = _mm256_add_epi64(w0Hi, blockStep0),
+				w1Lo = _mm256_add_epi64(w1Lo, blockStep1), w1Hi = _mm256_add_epi64(w1Hi, blockStep1),
+				w2Lo = _mm256_add_epi64(w2Lo, blockStep2), w2Hi = _mm256_add_epi64(w2Hi, blockStep2))
+			{
+				// Coverage: a pixel is outside as soon as one of its edge functions has the sign bit set
+				const int outsideLo = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_or_si256(_mm256_or_si256(w0Lo, w1Lo), w2Lo)));
+				const int outsideHi = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_or_si256(_mm256_or_si256(w0Hi, w1Hi), w2Hi)));
+				const int laneCount = std::min(LANES, max.x - px);
+				int mask = ~(outsideLo | (outsideHi << 4)) & ((1 << laneCount) - 1);
+				if (mask == 0) continue;
+
+				// Never touch the depth buffer past the end of the bounding box row
+				const __m256i inside = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(mask), laneBits), laneBits);
+				float* pDepth = &m_pDepthBufferPixels[m_Width * py + px];
+				const __m256 bufferDepth = _mm256_maskload_ps(pDepth, inside);
+
+				const __m256 b0 = _mm256_mul_ps(toFloat(w0Lo, w0Hi), invArea);
+				const __m256 b1 = _mm256_mul_ps(toFloat(w1Lo, w1Hi), invArea);
+				const __m256 b2 = _mm256_mul_ps(toFloat(w2Lo, w2Hi), invArea);
+				const __m256 z = InterpolateDepth8(numeratorZ, Z0, Z1, Z2, b0, b1, b2);
+				const __m256 w = InterpolateDepth8(numeratorW, W0, W1, W2, b0, b1, b2);
+
+				// Early depth test, frustum, behind camera and depth test. The "not" compares keep the scalar behaviour for NaNs
+				__m256 pass = _mm256_cmp_ps(minDepth, bufferDepth, _CMP_NGT_UQ);
+				pass = _mm256_and_ps(pass, _mm256_cmp_ps(z, zero, _CMP_NLT_UQ));
+				pass = _mm256_and_ps(pass, _mm256_cmp_ps(z, one, _CMP_NGT_UQ));
+				pass = _mm256_and_ps(pass, _mm256_cmp_ps(w, zero, _CMP_NLT_UQ));
+				pass = _mm256_and_ps(pass, _mm256_cmp_ps(z, bufferDepth, _CMP_NGT_UQ));
+				mask &= _mm256_movemask_ps(pass);
+				if (mask == 0) continue;
+
+				// Masked depth write, only for the pixels that passed (and not for transparent meshes)
+				const __m256i write = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(mask), laneBits), laneBits);
+				if constexpr (writeDepth) _mm256_maskstore_ps(pDepth, write, z);
+				passedPixels += std::popcount(static_cast<uint32_t>(mask));
+
+				// Deferred: only remember which triangle is visible, it is shaded once all triangles are rasterized
+				if (deferShading)
 				{
-					DrawBoundingBoxes(min, max);
+					_mm256_maskstore_epi32(reinterpret_cast<int*>(&m_pVisibilityBufferPixels[m_Width * py + px]), write, triangleIndices);
 					continue;
 				}
 
-				// For every pixel (within the bounding box)
-				for (int py{ int(min.y) }; py < int(max.y); ++py)
+				_mm256_store_ps(b0Lanes, b0);
+				_mm256_store_ps(b1Lanes, b1);
+				_mm256_store_ps(b2Lanes, b2);
+				_mm256_store_ps(zLanes, z);
+				_mm256_store_ps(wLanes, w);
+				for (int lane{}; lane < laneCount; ++lane)
 				{
-					for (int px{ int(min.x) }; px < int(max.x); ++px)
-					{
-						// Do an early depth test!!
-						// If the minimum depth of our triangle is already bigger than what is stored in the depth buffer (at a current pixel),
-						// there is no chance that that pixel inside the triangle will be closer, so we just skip to the next pixel
-						if (minDepth > m_pDepthBufferPixels[m_Width * py + px]) continue;
-
-						// Declare finalColor of the pixel
-						ColorRGB finalColor{};
-
-						// Declare wInterpolated and zBufferValue of this pixel
-						float wInterpolated{ FLT_MAX };
-						float zBufferValue{ FLT_MAX };
-
-						// Calculate the barycentric coordinates of that pixel in relationship to the triangle,
-						// these barycentric coordinates CAN be invalid (point outside triangle)
-						Vector2 pixelCoord = Vector2(px + 0.5f, py + 0.5f);
-						Vector3 barycentricCoords = CalculateBarycentricCoordinates(
-							v0, v1, v2, pixelCoord, invArea);
-
-						// Check if our barycentric coordinates are valid, if not, skip to the next pixel
-						if (!AreBarycentricValid(barycentricCoords)) continue;
-
-						// Now we interpolated both our Z and W depths
-						InterpolateDepths(zBufferValue, wInterpolated, triangleRasterVertices, barycentricCoords);
-						if (zBufferValue < 0 or zBufferValue > 1) continue; // if z-depth is outside of frustum, skip to next pixel
-						if (wInterpolated < 0) continue; // if w-depth is negative (behind camera), skip to next pixel
-
-						// If out current value in the zBuffer is smaller than our new one, skip to the next pixel
-						if (zBufferValue > m_pDepthBufferPixels[m_Width * py + px]) continue;
-
-						// Now that we are sure our z-depth is smaller than the one in the zBuffer, we can update the zBuffer and interpolate the attributes
-						// We only want to do this if there is no transparency
-						if (!currentMesh->HasTransparency())
-						{
-							m_pDepthBufferPixels[m_Width * py + px] = zBufferValue;
-						}
-
-						// Correctly interpolated attributes
-						VertexOut interpolatedAttributes{};
-						InterpolateAllAttributes(triangleRasterVertices, barycentricCoords, wInterpolated, interpolatedAttributes);
-						interpolatedAttributes.position.z = zBufferValue;
-						interpolatedAttributes.position.w = wInterpolated;
-
-						float alpha{ 1 };
-						finalColor = PixelShading(interpolatedAttributes, currentMesh, &alpha);
-
-						if (m_DepthBufferVisualization)
-						{
-							const float remappedZ = Remap01(m_pDepthBufferPixels[m_Width * py + px], 0.998f, 1);
-							finalColor = ColorRGB{ remappedZ , remappedZ , remappedZ };
-						}
-
-						// If our alpha is smaller than 0.999f, and thus we have (noticeable) transparency, blend the color with whatever is currently already in the buffer
-						//if (alpha < 0.999f)
-						{
-							// Request the color in the buffer
-							SDL_Color bufferColor{};
-							SDL_GetRGB(m_pBackBufferPixels[m_Width * py + px], m_pBackBuffer->format, &bufferColor.r, &bufferColor.g, &bufferColor.b);
-
-							// Put the SDL color in a ColorRGB
-							ColorRGB blendCol{};
-							blendCol.r = bufferColor.r;
-							blendCol.g = bufferColor.g;
-							blendCol.b = bufferColor.b;
-							blendCol /= 255.f;
-							blendCol.MaxToOne();
-
-							// Blend
-							finalColor *= alpha;
-							finalColor += (1 - alpha) * blendCol;
-						}
-
-						// Make sure our colors are within the correct 0-1 range (while keeping relative differences)
-						finalColor.MaxToOne();
-
-						//Update Color in Buffer
-						m_pBackBufferPixels[m_Width * py + px] = SDL_MapRGB(m_pBackBuffer->format,
-							static_cast<uint8_t>(finalColor.r * 255),
-							static_cast<uint8_t>(finalColor.g * 255),
-							static_cast<uint8_t>(finalColor.b * 255));
-					}
+					if (!(mask & (1 << lane))) continue;
+					const ColorRGB color = ShadePixel<Pipeline>(triangle, px + lane, py, { b0Lanes[lane], b1Lanes[lane], b2Lanes[lane] }, zLanes[lane], wLanes[lane]);
+					rLanes[lane] = color.r;
+					gLanes[lane] = color.g;
+					bLanes[lane] = color.b;
+				}
+				WritePixels(px, py, rLanes, gLanes, bLanes, mask);
+			}
+		}
+		return passedPixels;
+	}
+#endif
+	float Renderer::CalculateBlockMaxDepth(int blockX, int blockY) const
+	{
+		// Blocks on the right and bottom border of the screen can be partial
+		const int maxX = std::min((blockX + 1) * m_HIZ_BLOCK_SIZE, m_Width);
+		const int maxY = std::min((blockY + 1) * m_HIZ_BLOCK_SIZE, m_Height);
+
+		float maxDepth{ 0 };
+		for (int py{ blockY * m_HIZ_BLOCK_SIZE }; py < maxY; ++py)
+		{
+			for (int px{ blockX * m_HIZ_BLOCK_SIZE }; px < maxX; ++px)
+			{
+				maxDepth = std::max(maxDepth, m_pDepthBufferPixels[m_Width * py + px]);
+			}
+		}
+		return maxDepth;
+	}
+	void Renderer::ResolveVisibility(const Int2& clipMin, const Int2& clipMax)
+	{
+		// Every pixel the opaque triangles cover is shaded exactly once, with the triangle that ended up in front
+		uint64_t shadedPixels{};
+		alignas(32) float rLanes[m_PIXEL_BATCH_SIZE]{}, gLanes[m_PIXEL_BATCH_SIZE]{}, bLanes[m_PIXEL_BATCH_SIZE]{};
+		for (int py{ clipMin.y }; py < clipMax.y; ++py)
+		{
+			// Shade a run of pixels at a time so they can be packed and written together
+			for (int px{ clipMin.x }; px < clipMax.x; px += m_PIXEL_BATCH_SIZE)
+			{
+				const int laneCount = std::min(m_PIXEL_BATCH_SIZE, clipMax.x - px);
+				int mask{};
+				for (int lane{}; lane < laneCount; ++lane)
+				{
+					const uint32_t triangleIndex = m_pVisibilityBufferPixels[m_Width * py + px + lane];
+					if (triangleIndex == m_EMPTY_VISIBILITY) continue;
+
+					// Evaluating the edge functions at the pixel center gives the exact same values the rasterizer stepped to
+					const TriangleSetup& triangle = m_vTriangles[triangleIndex];
+					const Int2 pixelCenter{ ((px + lane) << SUBPIXEL_BITS) + SUBPIXEL_HALF, (py << SUBPIXEL_BITS) + SUBPIXEL_HALF };
+					const Vector3 barycentricCoords{
+						static_cast<float>(EvaluateEdgeFunction(triangle.edges[0], pixelCenter)) * triangle.invArea,
+						static_cast<float>(EvaluateEdgeFunction(triangle.edges[1], pixelCenter)) * triangle.invArea,
+						static_cast<float>(EvaluateEdgeFunction(triangle.edges[2], pixelCenter)) * triangle.invArea };
+
+					float wInterpolated{ FLT_MAX };
+					float zBufferValue{ FLT_MAX };
+					InterpolateDepths(zBufferValue, wInterpolated, triangle.vertices, barycentricCoords);
+
+					const ColorRGB color = (this->*m_SHADE_FUNCTIONS[triangle.pipeline])(triangle, px + lane, py, barycentricCoords, zBufferValue, wInterpolated);
+					rLanes[lane] = color.r;
+					gLanes[lane] = color.g;
+					bLanes[lane] = color.b;
+					mask |= 1 << lane;
 				}
+				if (!mask) continue;
+
+				WritePixels(px, py, rLanes, gLanes, bLanes, mask);
+				shadedPixels += std::popcount(static_cast<unsigned>(mask));
 			}
 		}
+		m_ShadedPixelCount += shadedPixels;
+	}
+	template<PixelPipeline Pipeline>
+	ColorRGB Renderer::ShadePixel(const TriangleSetup& triangle, int px, int py, const Vector3& barycentricCoords, float zBufferValue, float wInterpolated) const
+	{
+		Mesh* currentMesh = triangle.pMesh;
+
+		// Correctly interpolated attributes, only the ones this pipeline reads
+		VertexOut interpolatedAttributes{};
+		InterpolateVaryings<GetPixelShadingVaryings(Pipeline)>(triangle, barycentricCoords, wInterpolated, interpolatedAttributes);
+		interpolatedAttributes.position.z = zBufferValue;
+		interpolatedAttributes.position.w = wInterpolated;
+
+		UVDerivatives uvDerivatives{};
+		if constexpr (bool(GetPixelShadingVaryings(Pipeline) & VARYING_UV)) uvDerivatives = CalculateUVDerivatives(triangle, interpolatedAttributes.uv, wInterpolated);
+
+		float alpha{ 1 };
+		ColorRGB finalColor{};
+		if constexpr (Pipeline.depthView)
+		{
+			// Transparent meshes still need their alpha to blend
+			if constexpr (Pipeline.transparent) currentMesh->SampleDiffuse(interpolatedAttributes.uv, uvDerivatives, &alpha);
+
+			const float remappedZ = Remap01(m_pDepthBufferPixels[m_Width * py + px], 0.998f, 1);
+			finalColor = ColorRGB{ remappedZ , remappedZ , remappedZ };
+		}
+		else
+		{
+			finalColor = PixelShading<Pipeline>(interpolatedAttributes, uvDerivatives, currentMesh, &alpha);
+		}
+
+		// Only translucent meshes blend with whatever is currently already in the buffer, opaque ones (alpha 1) would just overwrite it
+		if constexpr (Pipeline.transparent)
+		{
+			// Request the color in the buffer
+			ColorRGB blendCol = UnpackColor(m_pBackBufferPixels[m_Width * py + px]);
+			blendCol.MaxToOne();
+
+			// Blend
+			finalColor *= alpha;
+			finalColor += (1 - alpha) * blendCol;
+		}
+
+		// Make sure our colors are within the correct 0-1 range (while keeping relative differences)
+		finalColor.MaxToOne();
+		return finalColor;
+	}
+	void Renderer::WritePixels(int px, int py, const float* r, const float* g, const float* b, int mask) const
+	{
+		uint32_t* pPixels = &m_pBackBufferPixels[m_Width * py + px];
+#if defined(AVX2_KERNELS)
+		if (m_SIMDRasterization)
+		{
+			StorePackedColors(pPixels, r, g, b, mask);
+			return;
+		}
+#endif
+		for (int lane{}; lane < m_PIXEL_BATCH_SIZE; ++lane)
+		{
+			if (mask & (1 << lane)) pPixels[lane] = PackColor({ r[lane], g[lane], b[lane] });
+		}
+	}
+	void Renderer::CreateBackBuffer()
+	{
+		// Renderer owned framebuffer in a fixed pixel format (SDL_PIXELFORMAT_RGB888, see PackColor),
+		// the SDL surface only wraps it to present and save it
+		m_pBackBufferPixels = new uint32_t[(m_Width * m_Height)];
+		m_pBackBuffer = SDL_CreateRGBSurfaceWithFormatFrom(m_pBackBufferPixels, m_Width, m_Height, 32,
+			m_Width * static_cast<int>(sizeof(uint32_t)), SDL_PIXELFORMAT_RGB888);
+	}
+	void Renderer::ClearBuffers(const ColorRGB& fillColor)
+	{
+		const uint32_t clearColor = PackColor(fillColor);
+
+		// Color, depth (and visibility) are cleared together, tile by tile in parallel
+		std::for_each(std::execution::par, m_vTileIndices.begin(), m_vTileIndices.end(), [&](int tileIndex)
+			{
+				const Int2 tileMin{ (tileIndex % m_TileCountX) * m_TILE_SIZE, (tileIndex / m_TileCountX) * m_TILE_SIZE };
+				const Int2 tileMax{ std::min(tileMin.x + m_TILE_SIZE, m_Width), std::min(tileMin.y + m_TILE_SIZE, m_Height) };
+				const int rowLength = tileMax.x - tileMin.x;
+
+				for (int py{ tileMin.y }; py < tileMax.y; ++py)
+				{
+					const int rowStart = m_Width * py + tileMin.x;
+					std::fill_n(&m_pBackBufferPixels[rowStart], rowLength, clearColor);
+					std::fill_n(&m_pDepthBufferPixels[rowStart], rowLength, 1.f);
+					if (m_DeferredShading) std::fill_n(&m_pVisibilityBufferPixels[rowStart], rowLength, m_EMPTY_VISIBILITY);
+				}
+			});
+
+		std::fill(m_vHiZBuffer.begin(), m_vHiZBuffer.end(), 1.f);
+	}
+	void Renderer::InitializeTiles()
+	{
+		m_TileCountX = (m_Width + m_TILE_SIZE - 1) / m_TILE_SIZE;
+		m_TileCountY = (m_Height + m_TILE_SIZE - 1) / m_TILE_SIZE;
+
+		m_vTileBins.resize(m_TileCountX * m_TileCountY);
+		m_vTileIndices.resize(m_TileCountX * m_TileCountY);
+		std::iota(m_vTileIndices.begin(), m_vTileIndices.end(), 0);
+	}
+	void Renderer::InitializeHiZ()
+	{
+		static_assert(m_TILE_SIZE % m_HIZ_BLOCK_SIZE == 0, "HiZ blocks can't cross tiles");
+
+		m_HiZCountX = (m_Width + m_HIZ_BLOCK_SIZE - 1) / m_HIZ_BLOCK_SIZE;
+		m_HiZCountY = (m_Height + m_HIZ_BLOCK_SIZE - 1) / m_HIZ_BLOCK_SIZE;
+
+		m_vHiZBuffer.resize(m_HiZCountX * m_HiZCountY);
 	}
 	void Renderer::DrawBoundingBoxes(const Vector2& min, const Vector2& max) const
 	{
@@ -569,53 +1275,239 @@ namespace dae {
 		{
 			for (int px{ int(min.x) }; px < int(max.x); ++px)
 			{
-				m_pBackBufferPixels[m_Width * py + px] = SDL_MapRGB(m_pBackBuffer->format,
-					255, 255, 255);
+				m_pBackBufferPixels[m_Width * py + px] = PackColor(colors::White);
 			}
 		}
 	}
 
-	void Renderer::ProjectMeshToNDC(Mesh* mesh) const
+	void Renderer::SelectLOD(Mesh* mesh)
+	{
+		// The simplifier only makes triangle lists
+		if (!m_LOD or mesh->GetLODCount() == 1 or mesh->GetPrimitiveTopology() != PrimitiveTopology::TriangleList)
+		{
+			mesh->SetCurrentLOD(0);
+			return;
+		}
+
+		// Pixels per object space unit at the point of the bounding sphere closest to the camera (world matrices are rigid)
+		const Vector3 center = mesh->GetWorldMatrix().TransformPoint(mesh->GetBoundingCenter());
+		const float distance = std::max((center - m_Camera.origin).Magnitude() - mesh->GetBoundingRadius(), m_Camera.nearPlane);
+		const float pixelsPerUnit = static_cast<float>(m_Height) * 0.5f / (distance * m_Camera.fov);
+
+		int lod = mesh->GetCurrentLOD();
+		while (lod > 0 and mesh->GetLODError(lod) * pixelsPerUnit > m_LOD_PIXEL_ERROR) --lod;
+		while (lod + 1 < mesh->GetLODCount() and mesh->GetLODError(lod + 1) * pixelsPerUnit < m_LOD_PIXEL_ERROR * m_LOD_HYSTERESIS) ++lod;
+		mesh->SetCurrentLOD(lod);
+	}
+	void Renderer::ProjectMeshToNDC(Mesh* mesh)
 	{
 		auto& verticesOut = mesh->GetVerticesOutByReference();
-		auto& vertices = mesh->GetVerticesByReference();
-		auto& worldMatrix = mesh->GetWorldMatrix();
+		auto& verticesScreen = mesh->GetVerticesScreenByReference();
+		auto& clipFlags = mesh->GetClipFlagsByReference();
+		const int vertexCount = static_cast<int>(mesh->GetVertexCount());
 
-		verticesOut.resize(vertices.size());
+		verticesOut.resize(vertexCount);
+		verticesScreen.resize(vertexCount);
+		clipFlags.resize(vertexCount);
 
 		// Calculate the transformation matrix
-		Matrix worldViewProjectionMatrix = worldMatrix * m_Camera.viewMatrix * m_Camera.projectionMatrix;
+		const Matrix& worldMatrix = mesh->GetWorldMatrix();
+		const Matrix worldViewProjectionMatrix = worldMatrix * m_Camera.viewMatrix * m_Camera.projectionMatrix;
 
-		for (int index{}; index < verticesOut.size(); ++index)
+		// Split the mesh in batches, so big meshes are transformed by all the worker threads
+		const int batchCount = (vertexCount + m_VERTEX_BATCH_SIZE - 1) / m_VERTEX_BATCH_SIZE;
+		if (static_cast<int>(m_vVertexBatchIndices.size()) < batchCount)
 		{
-			// Transform every vertex
-			Vector4 transformedPosition = worldViewProjectionMatrix.TransformPoint(vertices[index].position.ToPoint4());
-			verticesOut[index].position = transformedPosition;
+			m_vVertexBatchIndices.resize(batchCount);
+			std::iota(m_vVertexBatchIndices.begin(), m_vVertexBatchIndices.end(), 0);
+		}
 
-			if (verticesOut[index].position.w <= 0) continue;
+		std::for_each(std::execution::par, m_vVertexBatchIndices.begin(), m_vVertexBatchIndices.begin() + batchCount, [&](int batchIndex)
+			{
+				const int begin = batchIndex * m_VERTEX_BATCH_SIZE;
+				const int end = std::min(begin + m_VERTEX_BATCH_SIZE, vertexCount);
 
-			// Perform the perspective divide
-			float invW = 1.f / transformedPosition.w;
-			verticesOut[index].position.x *= invW;
-			verticesOut[index].position.y *= invW;
-			verticesOut[index].position.z *= invW;
+				int index{ begin };
+#if defined(AVX2_KERNELS)
+				if (m_SIMDRasterization) index = ProjectVerticesSIMD(mesh, worldMatrix, worldViewProjectionMatrix, begin, end);
+#endif
+				// Whatever is left (or everything, without SIMD)
+				for (; index < end; ++index)
+					ProjectVertex(mesh, worldMatrix, worldViewProjectionMatrix, index);
+			});
+	}
+	void Renderer::ProjectVertex(Mesh* mesh, const Matrix& worldMatrix, const Matrix& worldViewProjectionMatrix, int index) const
+	{
+		auto& verticesOut = mesh->GetVerticesOutByReference();
+		auto& verticesScreen = mesh->GetVerticesScreenByReference();
+		// Compact meshes are decoded on the fly
+		const Vertex vertex = mesh->DecodeVertex(index);
+
+		// Transform every vertex, the output stays in CLIP SPACE so triangles can still be clipped
+		verticesOut[index].position = worldViewProjectionMatrix.TransformPoint(vertex.position.ToPoint4());
+		mesh->GetClipFlagsByReference()[index] = CalculateClipFlags(verticesOut[index].position);
+
+		// Update the other attributes
+		verticesOut[index].color = vertex.color;
+		verticesOut[index].uv = vertex.uv;
+
+		verticesOut[index].normal = worldMatrix.TransformVector(vertex.normal).Normalized();
+		// Meshes with an object space normal map never read their tangents
+		if (mesh->HasTangents()) verticesOut[index].tangent = worldMatrix.TransformVector(vertex.tangent).Normalized();
+		verticesOut[index].worldPos = worldMatrix.TransformPoint(vertex.position);
+
+		// Post-transform screen space copy, the triangles that need no clipping only gather from this
+		verticesScreen[index] = verticesOut[index];
+		ClipToScreen(verticesScreen[index]);
+	}
+#if defined(AVX2_KERNELS)
+	AVX2_TARGET int Renderer::ProjectVerticesSIMD(Mesh* mesh, const Matrix& worldMatrix, const Matrix& worldViewProjectionMatrix, int begin, int end) const
+	{
+		// Same math as ProjectVertex for 8 vertices at once, read from the structure of arrays streams.
+		// Every operation happens in the same order as Matrix::TransformPoint/TransformVector and Vector3::Normalized,
+		// so the output is identical to the scalar path
+		constexpr int LANES{ 8 };
 
+		auto& verticesOut = mesh->GetVerticesOutByReference();
+		auto& verticesScreen = mesh->GetVerticesScreenByReference();
+		auto& clipFlags = mesh->GetClipFlagsByReference();
+		const auto& vertices = mesh->GetVerticesByReference();
+		const VertexStreams& streams = mesh->GetVertexStreams();
+		// Compact meshes are decoded exactly like Mesh::DecodeVertex does
+		const bool compact = mesh->HasCompactVertices();
+		const CompactVertexStreams& compactStreams = mesh->GetCompactVertexStreams();
+		// Meshes with an object space normal map have no tangent streams
+		const bool hasTangents = mesh->HasTangents();
+
+		// Broadcast every matrix element, m[row][column]
+		__m256 wvp[4][4]{};
+		__m256 world[4][4]{};
+		for (int row{}; row < 4; ++row)
+		{
+			for (int column{}; column < 4; ++column)
+			{
+				wvp[row][column] = _mm256_set1_ps(worldViewProjectionMatrix[row][column]);
+				world[row][column] = _mm256_set1_ps(worldMatrix[row][column]);
+			}
+		}
 
-			// Update the other attributes
-			verticesOut[index].color = vertices[index].color;
-			verticesOut[index].uv = vertices[index].uv;
+		alignas(32) float out[15][LANES]{};
 
-			verticesOut[index].normal = worldMatrix.TransformVector(vertices[index].normal).Normalized();
-			verticesOut[index].tangent = worldMatrix.TransformVector(vertices[index].tangent).Normalized();
-			verticesOut[index].worldPos = worldMatrix.TransformPoint(vertices[index].position);
+		int index{ begin };
+		for (; index + LANES <= end; index += LANES)
+		{
+			__m256 px{}, py{}, pz{};
+			if (compact)
+			{
+				px = LoadUnorm16x8(&compactStreams.positionX[index], compactStreams.positionScale.x, compactStreams.positionOffset.x);
+				py = LoadUnorm16x8(&compactStreams.positionY[index], compactStreams.positionScale.y, compactStreams.positionOffset.y);
+				pz = LoadUnorm16x8(&compactStreams.positionZ[index], compactStreams.positionScale.z, compactStreams.positionOffset.z);
+			}
+			else
+			{
+				px = _mm256_loadu_ps(&streams.positionX[index]);
+				py = _mm256_loadu_ps(&streams.positionY[index]);
+				pz = _mm256_loadu_ps(&streams.positionZ[index]);
+			}
+
+			// Position to clip space, w of the input point is 1 so the translation row is just added
+			_mm256_store_ps(out[0], _mm256_add_ps(Transform8(wvp, 0, px, py, pz), wvp[3][0]));
+			_mm256_store_ps(out[1], _mm256_add_ps(Transform8(wvp, 1, px, py, pz), wvp[3][1]));
+			_mm256_store_ps(out[2], _mm256_add_ps(Transform8(wvp, 2, px, py, pz), wvp[3][2]));
+			_mm256_store_ps(out[3], _mm256_add_ps(Transform8(wvp, 3, px, py, pz), wvp[3][3]));
+
+			// World space position, normal and tangent
+			_mm256_store_ps(out[4], _mm256_add_ps(Transform8(world, 0, px, py, pz), world[3][0]));
+			_mm256_store_ps(out[5], _mm256_add_ps(Transform8(world, 1, px, py, pz), world[3][1]));
+			_mm256_store_ps(out[6], _mm256_add_ps(Transform8(world, 2, px, py, pz), world[3][2]));
+
+			__m256 nx{}, ny{}, nz{};
+			if (compact) LoadOctahedral8(&compactStreams.normalX[index], &compactStreams.normalY[index], nx, ny, nz);
+			else
+			{
+				nx = _mm256_loadu_ps(&streams.normalX[index]);
+				ny = _mm256_loadu_ps(&streams.normalY[index]);
+				nz = _mm256_loadu_ps(&streams.normalZ[index]);
+			}
+			__m256 normalX = Transform8(world, 0, nx, ny, nz);
+			__m256 normalY = Transform8(world, 1, nx, ny, nz);
+			__m256 normalZ = Transform8(world, 2, nx, ny, nz);
+			Normalize8(normalX, normalY, normalZ);
+			_mm256_store_ps(out[7], normalX);
+			_mm256_store_ps(out[8], normalY);
+			_mm256_store_ps(out[9], normalZ);
+
+			if (hasTangents)
+			{
+				__m256 tx{}, ty{}, tz{};
+				if (compact) LoadOctahedral8(&compactStreams.tangentX[index], &compactStreams.tangentY[index], tx, ty, tz);
+				else
+				{
+					tx = _mm256_loadu_ps(&streams.tangentX[index]);
+					ty = _mm256_loadu_ps(&streams.tangentY[index]);
+					tz = _mm256_loadu_ps(&streams.tangentZ[index]);
+				}
+				__m256 tangentX = Transform8(world, 0, tx, ty, tz);
+				__m256 tangentY = Transform8(world, 1, tx, ty, tz);
+				__m256 tangentZ = Transform8(world, 2, tx, ty, tz);
+				Normalize8(tangentX, tangentY, tangentZ);
+				_mm256_store_ps(out[10], tangentX);
+				_mm256_store_ps(out[11], tangentY);
+				_mm256_store_ps(out[12], tangentZ);
+			}
+
+			if (compact)
+			{
+				_mm256_store_ps(out[13], LoadUnorm16x8(&compactStreams.u[index], compactStreams.uvScale.x, compactStreams.uvOffset.x));
+				_mm256_store_ps(out[14], LoadUnorm16x8(&compactStreams.v[index], compactStreams.uvScale.y, compactStreams.uvOffset.y));
+			}
+			else
+			{
+				_mm256_store_ps(out[13], _mm256_loadu_ps(&streams.u[index]));
+				_mm256_store_ps(out[14], _mm256_loadu_ps(&streams.v[index]));
+			}
+
+			// The rasterizer works on whole vertices, so write them back as an array of structures
+			for (int lane{}; lane < LANES; ++lane)
+			{
+				VertexOut& vertexOut = verticesOut[index + lane];
+				vertexOut.position = { out[0][lane], out[1][lane], out[2][lane], out[3][lane] };
+				vertexOut.worldPos = { out[4][lane], out[5][lane], out[6][lane] };
+				if (!compact)							vertexOut.color = vertices[index + lane].color;
+				else if (compactStreams.colors.empty())	vertexOut.color = compactStreams.uniformColor;
+				else									vertexOut.color = compactStreams.colors[index + lane];
+				vertexOut.uv = { out[13][lane], out[14][lane] };
+				vertexOut.normal = { out[7][lane], out[8][lane], out[9][lane] };
+				if (hasTangents) vertexOut.tangent = { out[10][lane], out[11][lane], out[12][lane] };
+
+				clipFlags[index + lane] = CalculateClipFlags(vertexOut.position);
+
+				verticesScreen[index + lane] = vertexOut;
+				ClipToScreen(verticesScreen[index + lane]);
+			}
 		}
+		return index;
 	}
+#endif
 	void Renderer::RasterizeVertex(VertexOut& vertex) const
 	{
 		vertex.position.x = (1.f + vertex.position.x) * 0.5f * m_Width;
 		vertex.position.y = (1.f - vertex.position.y) * 0.5f * m_Height;
 	}
-	void Renderer::InterpolateDepths(float& zDepth, float& wDepth, const std::array<VertexOut, 3>& triangle, const Vector3& weights)
+	void Renderer::ClipToScreen(VertexOut& vertex) const
+	{
+		// Behind the camera, these are always outside the near plane and never reach the rasterizer
+		if (vertex.position.w <= 0) return;
+
+		// Perform the perspective divide
+		const float invW = 1.f / vertex.position.w;
+		vertex.position.x *= invW;
+		vertex.position.y *= invW;
+		vertex.position.z *= invW;
+
+		RasterizeVertex(vertex);
+	}
+	void Renderer::InterpolateDepths(float& zDepth, float& wDepth, const std::array<VertexOut, 3>& triangle, const Vector3& weights) const
 	{
 		// Now we interpolated both our Z and W depths
 		const float& Z0 = triangle[0].position.z;
@@ -628,110 +1520,195 @@ namespace dae {
 		const float& W2 = triangle[2].position.w;
 		wDepth = InterpolateDepth(W0, W1, W2, weights);
 	}
-	void Renderer::InterpolateAllAttributes(const std::array<VertexOut, 3>& triangle, const Vector3& weights, const float wInterpolated, VertexOut& output)
+	void Renderer::SetupAttributePlanes(TriangleSetup& triangle) const
 	{
-		// Get W components
-		const float& W0 = triangle[0].position.w;
-		const float& W1 = triangle[1].position.w;
-		const float& W2 = triangle[2].position.w;
+		const VertexOut& v0 = triangle.vertices[0];
+		const VertexOut& v1 = triangle.vertices[1];
+		const VertexOut& v2 = triangle.vertices[2];
+		const Vector3 invW{ 1.f / v0.position.w, 1.f / v1.position.w, 1.f / v2.position.w };
+
+		// Only the varyings the pixel shader declares
+		const uint8_t varyings = GetPixelShadingVaryings(m_PIXEL_PIPELINES[triangle.pipeline]);
+		if (varyings & VARYING_UV)			SetAttributePlane(triangle.planes, VARYING_UV_OFFSET, 2, v0.uv, v1.uv, v2.uv, invW);
+		if (varyings & VARYING_NORMAL)		SetAttributePlane(triangle.planes, VARYING_NORMAL_OFFSET, 3, v0.normal, v1.normal, v2.normal, invW);
+		if (varyings & VARYING_TANGENT)		SetAttributePlane(triangle.planes, VARYING_TANGENT_OFFSET, 3, v0.tangent, v1.tangent, v2.tangent, invW);
+		if (varyings & VARYING_WORLD_POS)	SetAttributePlane(triangle.planes, VARYING_WORLD_POS_OFFSET, 3, v0.worldPos, v1.worldPos, v2.worldPos, invW);
+
+		if (varyings & VARYING_UV)
+		{
+			// One pixel to the right (or down) moves every edge function by A (or B), which gives the screen space gradients of the weights
+			AttributePlanes& planes = triangle.planes;
+			const float weight1dX = static_cast<float>(triangle.edges[1].a * SUBPIXEL_ONE) * triangle.invArea;
+			const float weight1dY = static_cast<float>(triangle.edges[1].b * SUBPIXEL_ONE) * triangle.invArea;
+			const float weight2dX = static_cast<float>(triangle.edges[2].a * SUBPIXEL_ONE) * triangle.invArea;
+			const float weight2dY = static_cast<float>(triangle.edges[2].b * SUBPIXEL_ONE) * triangle.invArea;
+
+			const Vector2 uvOverWDelta1{ planes.delta1[VARYING_UV_OFFSET], planes.delta1[VARYING_UV_OFFSET + 1] };
+			const Vector2 uvOverWDelta2{ planes.delta2[VARYING_UV_OFFSET], planes.delta2[VARYING_UV_OFFSET + 1] };
+			planes.uvOverWdX = uvOverWDelta1 * weight1dX + uvOverWDelta2 * weight2dX;
+			planes.uvOverWdY = uvOverWDelta1 * weight1dY + uvOverWDelta2 * weight2dY;
+			planes.invWdX = (invW.y - invW.x) * weight1dX + (invW.z - invW.x) * weight2dX;
+			planes.invWdY = (invW.y - invW.x) * weight1dY + (invW.z - invW.x) * weight2dY;
+		}
+	}
+	template<uint8_t Varyings>
+	void Renderer::InterpolateVaryings(const TriangleSetup& triangle, const Vector3& weights, const float wInterpolated, VertexOut& output) const
+	{
+		// Every varying is a plane of attribute / w, multiplying by the interpolated w makes it perspective correct again
+		const AttributePlanes& planes = triangle.planes;
+		const auto evaluateVector3 = [&](int offset)
+			{
+				return Vector3{ EvaluateAttributePlane(planes, offset, weights),
+								EvaluateAttributePlane(planes, offset + 1, weights),
+								EvaluateAttributePlane(planes, offset + 2, weights) };
+			};
 
-		// Correctly interpolated position
-		const Vector4& P0 = triangle[0].position;
-		const Vector4& P1 = triangle[1].position;
-		const Vector4& P2 = triangle[2].position;
-		output.position = InterpolateAttribute(P0, P1, P2, W0, W1, W2, wInterpolated, weights);
-
-		// Correctly interpolated color
-		const ColorRGB& C0 = triangle[0].color;
-		const ColorRGB& C1 = triangle[1].color;
-		const ColorRGB& C2 = triangle[2].color;
-		output.color = InterpolateAttribute(C0, C1, C2, W0, W1, W2, wInterpolated, weights);
-
-		// Correctly interpolated uv
-		const Vector2& UV0 = triangle[0].uv;
-		const Vector2& UV1 = triangle[1].uv;
-		const Vector2& UV2 = triangle[2].uv;
-		output.uv = InterpolateAttribute(UV0, UV1, UV2, W0, W1, W2, wInterpolated, weights);
-
-		// Correctly interpolated normal
-		const Vector3& N0 = triangle[0].normal;
-		const Vector3& N1 = triangle[1].normal;
-		const Vector3& N2 = triangle[2].normal;
-		output.normal = InterpolateAttribute(N0, N1, N2, W0, W1, W2, wInterpolated, weights);
-		output.normal.Normalize();
-
-		// Correctly interpolated tangent
-		const Vector3& T0 = triangle[0].tangent;
-		const Vector3& T1 = triangle[1].tangent;
-		const Vector3& T2 = triangle[2].tangent;
-		output.tangent = InterpolateAttribute(T0, T1, T2, W0, W1, W2, wInterpolated, weights);
-		output.tangent.Normalize();
-
-		// Correctly interpolated viewDirection
-		const Vector3& WP0 = triangle[0].worldPos;
-		const Vector3& WP1 = triangle[1].worldPos;
-		const Vector3& WP2 = triangle[2].worldPos;
-		output.worldPos = InterpolateAttribute(WP0, WP1, WP2, W0, W1, W2, wInterpolated, weights);
-	}
-
-	ColorRGB Renderer::PixelShading(const VertexOut& v, Mesh* m, float* alpha) const
-	{
-		// Ambient Color
-		constexpr ColorRGB ambient{ 0.025f, 0.025f, 0.025f };
-
-		// Set up the light
-		const Vector3 lightDirection = { m_Light.GetDirection() };
-		const Vector3 directionToLight = -lightDirection.Normalized();
-
-		// Sample the normal
-		Vector3 sampledNormal;
-		if (m_UseNormalMap and !m->HasTransparency())		sampledNormal = m->SampleNormalMap(v.normal, v.tangent, v.uv);
-		else												sampledNormal = v.normal;
-
-		// Calculate the observed area
-		const float observedArea = Vector3::Dot(sampledNormal, directionToLight);
-		// Skipping if observedArea < 0 happens when we check for the Current Shading Mode, as we really only want to skip (return black) if
-		// We are actually in a mode that uses observedArea (ObservedArea and Combined)
-
-		// Calculate the lambert diffuse color
-		const ColorRGB cd = m->SampleDiffuse(v.uv, alpha);
-		if (m->HasTransparency() or sampledNormal == v.normal) return cd;
-		const float kd = m_Light.GetIntensity();
-		const ColorRGB lambertDiffuse = (cd * kd) * ONE_DIV_PI;
-
-
-		// Calculate the specular
-		Vector3 viewDir = (v.worldPos - m_Camera.origin).Normalized();
-		constexpr float shininess = 25.f;
-		const ColorRGB specular = m->SamplePhong(directionToLight, viewDir, sampledNormal, v.uv, shininess);
+		if constexpr (bool(Varyings & VARYING_UV))
+		{
+			output.uv = Vector2{ EvaluateAttributePlane(planes, VARYING_UV_OFFSET, weights),
+								 EvaluateAttributePlane(planes, VARYING_UV_OFFSET + 1, weights) } * wInterpolated;
+		}
+		// Normal and tangent get normalized anyway, so they can skip the multiply by w
+		if constexpr (bool(Varyings & VARYING_NORMAL))		output.normal = evaluateVector3(VARYING_NORMAL_OFFSET).Normalized();
+		if constexpr (bool(Varyings & VARYING_TANGENT))		output.tangent = evaluateVector3(VARYING_TANGENT_OFFSET).Normalized();
+		if constexpr (bool(Varyings & VARYING_WORLD_POS))	output.worldPos = evaluateVector3(VARYING_WORLD_POS_OFFSET) * wInterpolated;
+	}
 
+	UVDerivatives Renderer::CalculateUVDerivatives(const TriangleSetup& triangle, const Vector2& uv, float wInterpolated) const
+	{
+		// uv = (uv / w) / (1 / w), so its exact screen space derivative is ((uv / w)' - uv * (1 / w)') * w
+		const AttributePlanes& planes = triangle.planes;
+		return UVDerivatives{ (planes.uvOverWdX - uv * planes.invWdX) * wInterpolated,
+							  (planes.uvOverWdY - uv * planes.invWdY) * wInterpolated };
+	}
+	constexpr uint8_t Renderer::GetPixelShadingVaryings(const PixelPipeline& pipeline)
+	{
+		// The depth view only shows depth (and the alpha of transparent meshes), without a normal map (or for transparent meshes)
+		// PixelShading stops at the diffuse color
+		if (pipeline.depthView)							return pipeline.transparent ? VARYING_UV : 0;
+		if (pipeline.transparent or !pipeline.normalMap)	return VARYING_UV;
 
-		switch (m_CurrentShadingMode)
+		// An object space normal map gives the whole normal
+		if (pipeline.objectSpaceNormals)
+			return pipeline.shadingMode == ShadingMode::ObservedArea or pipeline.shadingMode == ShadingMode::Diffuse ? VARYING_UV : VARYING_UV | VARYING_WORLD_POS;
+
+		switch (pipeline.shadingMode)
 		{
 		case ShadingMode::ObservedArea:
-			if (observedArea <= 0.f) return{};
-			return ColorRGB{ observedArea, observedArea, observedArea };
-			break;
 		case ShadingMode::Diffuse:
-			return lambertDiffuse;
-			break;
-		case ShadingMode::Specular:
-			return specular;
-			break;
-		case ShadingMode::Combined:
-			if (observedArea <= 0.f) return{};
-			return (lambertDiffuse + specular + ambient) * observedArea;
-			break;
+			return VARYING_UV | VARYING_NORMAL | VARYING_TANGENT;
 		default:
+			return VARYING_UV | VARYING_NORMAL | VARYING_TANGENT | VARYING_WORLD_POS;
+		}
+	}
+	uint8_t Renderer::SelectSetupPipeline(const Mesh* m) const
+	{
+		// Wire frames are drawn before culling, transparent meshes are never culled
+		SetupPipeline pipeline{};
+		if (m_DrawWireFrames)
+		{
+			pipeline.wireFrame = true;
+		}
+		else
+		{
+			pipeline.cullMode = m->HasTransparency() ? CullMode::None : m_CurrentCullMode;
+			pipeline.boundingBoxes = m_BoundingBoxVisualization;
+		}
+		return static_cast<uint8_t>(std::find(m_SETUP_PIPELINES.begin(), m_SETUP_PIPELINES.end(), pipeline) - m_SETUP_PIPELINES.begin());
+	}
+	uint8_t Renderer::SelectPixelPipeline(const Mesh* m, bool objectSpaceNormals) const
+	{
+		// Only keep the state that changes the result, so equivalent states share a variant
+		PixelPipeline pipeline{};
+		pipeline.transparent = m->HasTransparency();
+		pipeline.depthView = m_DepthBufferVisualization;
+		if (!pipeline.transparent and !pipeline.depthView and m_UseNormalMap)
+		{
+			pipeline.normalMap = true;
+			pipeline.objectSpaceNormals = objectSpaceNormals;
+			pipeline.shadingMode = m_CurrentShadingMode;
+		}
+		return static_cast<uint8_t>(std::find(m_PIXEL_PIPELINES.begin(), m_PIXEL_PIPELINES.end(), pipeline) - m_PIXEL_PIPELINES.begin());
+	}
+	template<PixelPipeline Pipeline>
+	ColorRGB Renderer::PixelShading(const VertexOut& v, const UVDerivatives& uvDerivatives, Mesh* m, float* alpha) const
+	{
+		// Transparent meshes, and everything when the normal map is off, only show their diffuse color
+		if constexpr (Pipeline.transparent or !Pipeline.normalMap)
+		{
+			return m->SampleDiffuse(v.uv, uvDerivatives, alpha);
+		}
+		else
+		{
+			// Ambient Color
+			constexpr ColorRGB ambient{ 0.025f, 0.025f, 0.025f };
+
+			// Set up the light
+			const Vector3 lightDirection = { m_Light.GetDirection() };
+			const Vector3 directionToLight = -lightDirection.Normalized();
+
+			// Sample the normal, specular and glossiness at once
+			const MaterialSample material = m->SampleMaterial(v.uv, uvDerivatives, Pipeline.objectSpaceNormals);
+			Vector3 sampledNormal{};
+			if constexpr (Pipeline.objectSpaceNormals)	sampledNormal = m->SampleObjectSpaceNormal(material);
+			else										sampledNormal = m->SampleNormalMap(v.normal, v.tangent, material);
+
+			// Calculate the observed area
+			const float observedArea = Vector3::Dot(sampledNormal, directionToLight);
+			if constexpr (Pipeline.shadingMode == ShadingMode::ObservedArea)
+			{
+				if (observedArea <= 0.f) return{};
+				return ColorRGB{ observedArea, observedArea, observedArea };
+			}
+
+			// Calculate the specular
+			constexpr float shininess = 25.f;
+			if constexpr (Pipeline.shadingMode == ShadingMode::Specular)
+			{
+				const Vector3 viewDir = (v.worldPos - m_Camera.origin).Normalized();
+				return m->SamplePhong(directionToLight, viewDir, sampledNormal, material, shininess);
+			}
+
+			// Calculate the lambert diffuse color
+			const ColorRGB cd = m->SampleDiffuse(v.uv, uvDerivatives, alpha);
+			if constexpr (!Pipeline.objectSpaceNormals)
+			{
+				if (sampledNormal == v.normal) return cd;
+			}
+			const float kd = m_Light.GetIntensity();
+			const ColorRGB lambertDiffuse = (cd * kd) * ONE_DIV_PI;
+			if constexpr (Pipeline.shadingMode == ShadingMode::Diffuse) return lambertDiffuse;
+
+			// Combined, skipping if observedArea < 0
+			if (observedArea <= 0.f) return{};
+			const Vector3 viewDir = (v.worldPos - m_Camera.origin).Normalized();
+			const ColorRGB specular = m->SamplePhong(directionToLight, viewDir, sampledNormal, material, shininess);
 			return (lambertDiffuse + specular + ambient) * observedArea;
-			break;
 		}
 	}
 
+	// One instantiation of the templated pipeline per variant, indexed like m_SETUP_PIPELINES and m_PIXEL_PIPELINES
+	const std::array<Renderer::AssembleFunction, Renderer::m_SETUP_PIPELINES.size()> Renderer::m_ASSEMBLE_FUNCTIONS =
+		[]<size_t... Indices>(std::index_sequence<Indices...>)
+		{
+			return std::array<AssembleFunction, sizeof...(Indices)>{ &Renderer::AssembleTriangles<m_SETUP_PIPELINES[Indices]>... };
+		}(std::make_index_sequence<m_SETUP_PIPELINES.size()>());
+	const std::array<Renderer::RasterizeFunction, Renderer::m_PIXEL_PIPELINES.size()> Renderer::m_RASTERIZE_FUNCTIONS =
+		[]<size_t... Indices>(std::index_sequence<Indices...>)
+		{
+			return std::array<RasterizeFunction, sizeof...(Indices)>{ &Renderer::RasterizeTriangle<m_PIXEL_PIPELINES[Indices]>... };
+		}(std::make_index_sequence<m_PIXEL_PIPELINES.size()>());
+	const std::array<Renderer::ShadeFunction, Renderer::m_PIXEL_PIPELINES.size()> Renderer::m_SHADE_FUNCTIONS =
+		[]<size_t... Indices>(std::index_sequence<Indices...>)
+		{
+			return std::array<ShadeFunction, sizeof...(Indices)>{ &Renderer::ShadePixel<m_PIXEL_PIPELINES[Indices]>... };
+		}(std::make_index_sequence<m_PIXEL_PIPELINES.size()>());
+
 
 	//--------------------------------------------------
 	//    DirectX Rasterizer PRIVATE
 	//--------------------------------------------------
+#if !defined(SOFTWARE_ONLY)
 	HRESULT Renderer::InitializeDirectX()
 	{
 		// 1. Create Device & DeviceContext
@@ -865,6 +1842,7 @@ namespace dae {
 
 		return S_OK;
 	}
+#endif
 }
 
 void Renderer::DrawLine(int x0, int y0, int x1, int y1, const ColorRGB& color) const
@@ -884,10 +1862,7 @@ void Renderer::DrawLine(int x0, int y0, int x1, int y1, const ColorRGB& color) c
 		if (y0 < m_Height and y0 >= 0
 			and x0 < m_Width and x0 >= 0)
 		{
-			m_pBackBufferPixels[m_Width * y0 + x0] = SDL_MapRGB(m_pBackBuffer->format,
-				static_cast<uint8_t>(color.r * 255),
-				static_cast<uint8_t>(color.g * 255),
-				static_cast<uint8_t>(color.b * 255));
+			m_pBackBufferPixels[m_Width * y0 + x0] = PackColor(color);
 		}
 
 		if (x0 == x1 && y0 == y1) break;
@@ -1,5 +1,8 @@
 #pragma once
+#include <array>
+#include <atomic>
 #include <map>
+#include <string>
 #include <vector>
 
 #include "Effect.h"
@@ -13,6 +16,79 @@ struct SDL_Surface;
 
 namespace dae
 {
+	// E(x, y) = A * x + B * y + C, with x and y in fixed point SCREEN SPACE
+	struct EdgeFunction
+	{
+		int64_t a{};
+		int64_t b{};
+		int64_t c{};
+	};
+
+	// The attributes a pixel shader reads, only those get interpolated
+	enum Varying : uint8_t
+	{
+		VARYING_UV			= 1 << 0,
+		VARYING_NORMAL		= 1 << 1,
+		VARYING_TANGENT		= 1 << 2,
+		VARYING_WORLD_POS	= 1 << 3,
+	};
+	// Offset of every varying in the attribute planes
+	constexpr int VARYING_UV_OFFSET{ 0 };
+	constexpr int VARYING_NORMAL_OFFSET{ 2 };
+	constexpr int VARYING_TANGENT_OFFSET{ 5 };
+	constexpr int VARYING_WORLD_POS_OFFSET{ 8 };
+	constexpr int VARYING_FLOAT_COUNT{ 11 };
+
+	// Attribute / w is linear in screen space, so over a triangle it is a plane of the barycentric weights:
+	// base + w1 * delta1 + w2 * delta2 (with base the value at vertex 0)
+	struct AttributePlanes
+	{
+		std::array<float, VARYING_FLOAT_COUNT> base{};
+		std::array<float, VARYING_FLOAT_COUNT> delta1{};
+		std::array<float, VARYING_FLOAT_COUNT> delta2{};
+
+		// Screen space gradients of uv / w and 1 / w, the texture level of detail is derived from them
+		Vector2 uvOverWdX{};
+		Vector2 uvOverWdY{};
+		float invWdX{};
+		float invWdY{};
+	};
+
+	// Compile time render state of the software pipeline. Every combination gets its own instantiation of the hot loops,
+	// which is picked once per draw, so those loops carry no state checks
+	struct SetupPipeline
+	{
+		CullMode cullMode{ CullMode::None };
+		bool wireFrame{};
+		bool boundingBoxes{};
+
+		bool operator==(const SetupPipeline&) const = default;
+	};
+	struct PixelPipeline
+	{
+		bool transparent{};
+		bool normalMap{};
+		bool objectSpaceNormals{};	// the normal map of the mesh is baked to object space, it needs no normals and tangents
+		bool depthView{};
+		ShadingMode shadingMode{ ShadingMode::Combined };
+
+		bool operator==(const PixelPipeline&) const = default;
+	};
+
+	// Screen space triangle after setup, ready to be rasterized
+	struct TriangleSetup
+	{
+		std::array<VertexOut, 3> vertices{};
+		std::array<EdgeFunction, 3> edges{};	// positive inside, edge i gives the weight of vertex i
+		Int2 min{};
+		Int2 max{};
+		float minDepth{};
+		float invArea{};						// inverse of the fixed point (doubled) area
+		Mesh* pMesh{};
+		uint8_t pipeline{};						// index of its PixelPipeline
+		AttributePlanes planes{};
+	};
+
 	class Renderer final
 	{
 	public:
@@ -20,6 +96,10 @@ namespace dae
 		//    Constructors and Destructors
 		//--------------------------------------------------
 		Renderer(SDL_Window* pWindow);
+#if defined(SOFTWARE_ONLY)
+		// Headless renderer without a window, renders into an offscreen framebuffer
+		Renderer(int width, int height);
+#endif
 		~Renderer();
 
 		Renderer(const Renderer&) = delete;
@@ -32,13 +112,18 @@ namespace dae
 		//    Renderer
 		//--------------------------------------------------
 		void Update(const Timer* pTimer);
+		void Update(float elapsedSec);
 		void Render();
 
+		bool SaveBufferToImage(const std::string& path) const;
+
 
 		//--------------------------------------------------
 		//    Rasterizer Shared
 		//--------------------------------------------------
 		void CycleCullMode();
+		void CycleSamplingStates();
+		void SetSamplingState(SamplerState samplerState);
 
 		void ToggleRenderer();
 		void ToggleMeshRotation();
@@ -55,14 +140,29 @@ namespace dae
 		void ToggleNormalMap();
 		void ToggleBoundingBox();
 		void ToggleWireFrames();
+		void ToggleTiledRasterization();
+		void ToggleSIMDRasterization();
+		void ToggleDeferredShading();
+		void ToggleTextureLayout();
+		void ToggleLOD();
+		// Quantizes the software vertices of every mesh, there is no going back to full precision
+		void CompactMeshVertices();
+
+		// Statistics of the last software frame, forward shading shades every pixel that passes the depth test
+		uint64_t GetShadedPixelCount() const { return m_ShadedPixelCount; }
+		uint64_t GetDepthPassCount() const { return m_DepthPassCount; }
+		// Triangles of the meshes drawn at their selected LOD, and how many fewer that is than at full detail
+		uint64_t GetLODTriangleCount() const { return m_LODTriangleCount; }
+		uint64_t GetLODSavedTriangleCount() const { return m_LODSavedTriangleCount; }
 
 		//--------------------------------------------------
 		//    DirectX Rasterizer
 		//--------------------------------------------------
-		void CycleSamplingStates();
 		void ToggleShadows();
 
 	private:
+		void LoadScene();
+
 		DirectionalLight m_Light;
 
 		//--------------------------------------------------
@@ -78,6 +178,7 @@ namespace dae
 		uint32_t* m_pBackBufferPixels	{ };
 
 		float* m_pDepthBufferPixels		{ };
+		uint32_t* m_pVisibilityBufferPixels	{ };	// index in m_vTriangles of the visible triangle, deferred shading only
 
 		//--------------------------------------------------
 		//    Rasterizer Shared PRIVATE
@@ -85,6 +186,7 @@ namespace dae
 		bool m_SoftwareRasterizer		{ false };
 		bool m_RotateMesh				{ true };
 		bool m_DoUniformColor			{ false };
+		SamplerState m_CurrentSamplerState{ SamplerState::Point };
 
 		const ColorRGB m_UNIFORM_COLOR	{ 0.1f, 0.1f, 0.1f };
 
@@ -96,14 +198,48 @@ namespace dae
 		//    Software Rasterizer PRIVATE
 		//--------------------------------------------------
 		void RenderCPU();
+		void RasterizeTiles();
+		void RasterizeTriangle(const TriangleSetup& triangle, const Int2& clipMin, const Int2& clipMax);
+		template<PixelPipeline Pipeline>
+		void RasterizeTriangle(const TriangleSetup& triangle, const Int2& clipMin, const Int2& clipMax);
+		template<PixelPipeline Pipeline>
+		int RasterizeBlock(const TriangleSetup& triangle, uint32_t triangleIndex, const Int2& min, const Int2& max);
+#if defined(AVX2_KERNELS)
+		template<PixelPipeline Pipeline>
+		int RasterizeBlockSIMD(const TriangleSetup& triangle, uint32_t triangleIndex, const Int2& min, const Int2& max);
+#endif
+		void ResolveVisibility(const Int2& clipMin, const Int2& clipMax);
+		template<PixelPipeline Pipeline>
+		ColorRGB ShadePixel(const TriangleSetup& triangle, int px, int py, const Vector3& barycentricCoords, float zBufferValue, float wInterpolated) const;
+		void WritePixels(int px, int py, const float* r, const float* g, const float* b, int mask) const;
 		void DrawBoundingBoxes(const Vector2& min, const Vector2& max) const;
 
-		void ProjectMeshToNDC(Mesh* mesh) const;
+		void SelectLOD(Mesh* mesh);
+		void ProjectMeshToNDC(Mesh* mesh);
+		void ProjectVertex(Mesh* mesh, const Matrix& worldMatrix, const Matrix& worldViewProjectionMatrix, int index) const;
+#if defined(AVX2_KERNELS)
+		int ProjectVerticesSIMD(Mesh* mesh, const Matrix& worldMatrix, const Matrix& worldViewProjectionMatrix, int begin, int end) const;
+#endif
 		void RasterizeVertex(VertexOut& vertex) const;
-		void InterpolateDepths(float& zDepth, float& wDepth, const std::array<VertexOut, 3>& triangle, const Vector3& weights);
-		void InterpolateAllAttributes(const std::array<VertexOut, 3>& triangle, const Vector3& weights, const float wInterpolated, VertexOut& output);
+		void ClipToScreen(VertexOut& vertex) const;
+		template<SetupPipeline Pipeline>
+		void AssembleTriangles(Mesh* currentMesh, uint8_t pixelPipeline, uint8_t tangentSpacePipeline);
+		template<SetupPipeline Pipeline, typename IndexType>
+		void AssembleIndexedTriangles(Mesh* currentMesh, const std::vector<IndexType>& indices, const uint32_t* pSourceTriangles, uint8_t pixelPipeline, uint8_t tangentSpacePipeline);
+		template<SetupPipeline Pipeline>
+		void SetupTriangle(const std::array<VertexOut, 3>& triangleRasterVertices, Mesh* currentMesh, uint8_t pixelPipeline);
+		template<SetupPipeline Pipeline>
+		void ClipTriangle(const std::array<VertexOut, 3>& triangleClip, uint8_t clipFlags, Mesh* currentMesh, uint8_t pixelPipeline);
+		void InterpolateDepths(float& zDepth, float& wDepth, const std::array<VertexOut, 3>& triangle, const Vector3& weights) const;
+		void SetupAttributePlanes(TriangleSetup& triangle) const;
+		template<uint8_t Varyings>
+		void InterpolateVaryings(const TriangleSetup& triangle, const Vector3& weights, const float wInterpolated, VertexOut& output) const;
 
-		ColorRGB PixelShading(const VertexOut& v, Mesh* m, float* alpha) const;
+		UVDerivatives CalculateUVDerivatives(const TriangleSetup& triangle, const Vector2& uv, float wInterpolated) const;
+
+		template<PixelPipeline Pipeline>
+		ColorRGB PixelShading(const VertexOut& v, const UVDerivatives& uvDerivatives, Mesh* m, float* alpha) const;
+		static constexpr uint8_t GetPixelShadingVaryings(const PixelPipeline& pipeline);
 		void DrawLine(int x0, int y0, int x1, int y1, const ColorRGB& color) const;
 
 		ShadingMode m_CurrentShadingMode		{ ShadingMode::Combined };
@@ -112,12 +248,98 @@ namespace dae
 		bool m_UseNormalMap						{ true };
 		bool m_BoundingBoxVisualization			{ false };
 		bool m_DrawWireFrames					{ false };
+		TextureLayout m_TextureLayout			{ TextureLayout::Tiled };
 		const ColorRGB m_SOFTWARE_COLOR			{ 0.39f, 0.39f, 0.39f };
 
+		// Pipeline variants, see SetupPipeline and PixelPipeline
+		uint8_t SelectSetupPipeline(const Mesh* m) const;
+		uint8_t SelectPixelPipeline(const Mesh* m, bool objectSpaceNormals) const;
+
+		static constexpr std::array<SetupPipeline, 7> m_SETUP_PIPELINES
+		{
+			SetupPipeline{ .wireFrame = true },
+			SetupPipeline{ .cullMode = CullMode::BackFace, .boundingBoxes = true },
+			SetupPipeline{ .cullMode = CullMode::FrontFace, .boundingBoxes = true },
+			SetupPipeline{ .cullMode = CullMode::None, .boundingBoxes = true },
+			SetupPipeline{ .cullMode = CullMode::BackFace },
+			SetupPipeline{ .cullMode = CullMode::FrontFace },
+			SetupPipeline{ .cullMode = CullMode::None },
+		};
+		static constexpr std::array<PixelPipeline, 12> m_PIXEL_PIPELINES
+		{
+			PixelPipeline{ },
+			PixelPipeline{ .normalMap = true, .shadingMode = ShadingMode::ObservedArea },
+			PixelPipeline{ .normalMap = true, .shadingMode = ShadingMode::Diffuse },
+			PixelPipeline{ .normalMap = true, .shadingMode = ShadingMode::Specular },
+			PixelPipeline{ .normalMap = true, .shadingMode = ShadingMode::Combined },
+			PixelPipeline{ .normalMap = true, .objectSpaceNormals = true, .shadingMode = ShadingMode::ObservedArea },
+			PixelPipeline{ .normalMap = true, .objectSpaceNormals = true, .shadingMode = ShadingMode::Diffuse },
+			PixelPipeline{ .normalMap = true, .objectSpaceNormals = true, .shadingMode = ShadingMode::Specular },
+			PixelPipeline{ .normalMap = true, .objectSpaceNormals = true, .shadingMode = ShadingMode::Combined },
+			PixelPipeline{ .transparent = true },
+			PixelPipeline{ .depthView = true },
+			PixelPipeline{ .transparent = true, .depthView = true },
+		};
+
+		using AssembleFunction = void (Renderer::*)(Mesh*, uint8_t, uint8_t);
+		using RasterizeFunction = void (Renderer::*)(const TriangleSetup&, const Int2&, const Int2&);
+		using ShadeFunction = ColorRGB(Renderer::*)(const TriangleSetup&, int, int, const Vector3&, float, float) const;
+		static const std::array<AssembleFunction, m_SETUP_PIPELINES.size()> m_ASSEMBLE_FUNCTIONS;
+		static const std::array<RasterizeFunction, m_PIXEL_PIPELINES.size()> m_RASTERIZE_FUNCTIONS;
+		static const std::array<ShadeFunction, m_PIXEL_PIPELINES.size()> m_SHADE_FUNCTIONS;
+
+		// Renderer owned framebuffer, presented to SDL at the end of the frame
+		void CreateBackBuffer();
+		void ClearBuffers(const ColorRGB& fillColor);
+
+		static constexpr int m_PIXEL_BATCH_SIZE	{ 8 };
+
+		// Sort-middle tiled rasterization
+		void InitializeTiles();
+
+		static constexpr int m_TILE_SIZE		{ 64 };
+		bool m_TiledRasterization				{ true };
+		bool m_DeferredShading					{ false };
+		bool m_SIMDSupported					{ false };	// built with the AVX2 kernels and the CPU can run them
+		bool m_SIMDRasterization				{ false };	// AVX2 raster and vertex kernels, on by default when supported
+		int m_TileCountX						{ };
+		int m_TileCountY						{ };
+		std::vector<TriangleSetup> m_vTriangles	{ };
+		std::vector<std::vector<uint32_t>> m_vTileBins{ };
+		std::vector<int> m_vTileIndices			{ };
+
+		// Vertex stage, meshes are transformed in batches spread over the worker threads
+		static constexpr int m_VERTEX_BATCH_SIZE{ 1024 };
+		std::vector<int> m_vVertexBatchIndices	{ };
+
+		// Mesh LODs, picked so their error stays below m_LOD_PIXEL_ERROR pixels. Going to a coarser LOD needs the error to be
+		// below m_LOD_HYSTERESIS times that, so a mesh right at the boundary does not switch back and forth every frame
+		static constexpr float m_LOD_PIXEL_ERROR{ 1.f };
+		static constexpr float m_LOD_HYSTERESIS{ 0.75f };
+		bool m_LOD								{ true };
+		uint64_t m_LODTriangleCount				{ };
+		uint64_t m_LODSavedTriangleCount		{ };
+
+		// Hierarchical Z, the furthest depth of every block of pixels
+		void InitializeHiZ();
+		float CalculateBlockMaxDepth(int blockX, int blockY) const;
+
+		static constexpr int m_HIZ_BLOCK_SIZE	{ 8 };
+		int m_HiZCountX							{ };
+		int m_HiZCountY							{ };
+		std::vector<float> m_vHiZBuffer			{ };
+
+		// Visibility buffer (deferred shading)
+		static constexpr uint32_t m_EMPTY_VISIBILITY{ UINT32_MAX };
+		std::atomic<uint64_t> m_ShadedPixelCount		{ };
+		std::atomic<uint64_t> m_DepthPassCount			{ };
+
 		//--------------------------------------------------
 		//    DirectX Rasterizer PRIVATE
 		//--------------------------------------------------
+#if !defined(SOFTWARE_ONLY)
 		HRESULT InitializeDirectX();
+#endif
 
 		bool m_IsInitialized			{ false };
 		bool m_FireVisible				{ true };
@@ -132,8 +354,6 @@ namespace dae
 		ID3D11Resource* m_pRenderTargetBuffer			{ nullptr };
 		ID3D11RenderTargetView* m_pRenderTargetView		{ nullptr };
 
-		SamplerState m_CurrentSamplerState				{ SamplerState::Point };
-
 		// Rasterizer States
 		ID3D11RasterizerState* m_pRasterizerStateFront		= nullptr;
 		ID3D11RasterizerState* m_pRasterizerStateBack		= nullptr;
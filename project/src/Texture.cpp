@@ -1,14 +1,45 @@
 #include "Texture.h"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <execution>
 #include <iostream>
+#include <numeric>
+#include <stdexcept>
 #include <SDL_image.h>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	// Every 8 bit channel value divided by 255, a lookup is cheaper (and gives the exact same floats) as the division
+	const std::array<float, 256> UNORM8_TO_FLOAT = []
+		{
+			std::array<float, 256> table{};
+			for (int value{}; value < 256; ++value)
+				table[value] = value / 255.f;
+			return table;
+		}();
+}
 
 //--------------------------------------------------
 //    Constructor and Destructor
 //--------------------------------------------------
 Texture::Texture(SDL_Surface* pSurface, ID3D11Device* pDevice)
-	: m_pSurface{ pSurface }
-	, m_pSurfacePixels{ static_cast<uint32_t*>(pSurface->pixels) }
+	: m_Width{ pSurface->w }
+	, m_Height{ pSurface->h }
+	, m_Log2Size{ std::log2(static_cast<float>(std::max(pSurface->w, pSurface->h))) }
 {
+	ConvertTexels(pSurface);
+	GenerateMipLevels();
+	SetLayout(TextureLayout::Tiled);
+
+#if defined(SOFTWARE_ONLY)
+	// Null GPU backend, the texture only lives on the CPU
+	(void)pDevice;
+#else
 	if (pDevice == nullptr)
 	{
 		std::wcout << L"Loading Texture on CPU and not GPU! pDevice was nullptr!\n";
@@ -53,17 +84,23 @@ Texture::Texture(SDL_Surface* pSurface, ID3D11Device* pDevice)
 		std::wcout << L"Could not create SRV!";
 		return;
 	}
+#endif
+}
+Texture::Texture(int width, int height, std::vector<uint32_t>&& vTexels)
+	: m_vTexels{ std::move(vTexels) }
+	, m_Width{ width }
+	, m_Height{ height }
+	, m_Log2Size{ std::log2(static_cast<float>(std::max(width, height))) }
+{
+	GenerateMipLevels();
+	SetLayout(TextureLayout::Tiled);
 }
 Texture::~Texture()
 {
-	if (m_pSurface)
-	{
-		SDL_FreeSurface(m_pSurface);
-		m_pSurface = nullptr;
-	}
-
+#if !defined(SOFTWARE_ONLY)
 	if (m_pSRV)			m_pSRV->Release();
 	if (m_pResource)	m_pResource->Release();
+#endif
 }
 
 
@@ -79,7 +116,74 @@ Texture* Texture::LoadFromFile(const std::string& path, ID3D11Device* pDevice)
 		throw std::runtime_error("Failed to load texture");
 	}
 
-	return new Texture(pSurface, pDevice);
+	// The texture keeps its own copy of the pixels, the surface is only needed while creating it
+	Texture* pTexture{};
+	try
+	{
+		pTexture = new Texture(pSurface, pDevice);
+	}
+	catch (...)
+	{
+		SDL_FreeSurface(pSurface);
+		throw;
+	}
+	SDL_FreeSurface(pSurface);
+	return pTexture;
+}
+Texture* Texture::CreatePacked(const std::array<TextureChannel, 4>& channels)
+{
+	// Every channel has to cover the same texels
+	int width{};
+	int height{};
+	for (const TextureChannel& channel : channels)
+	{
+		if (channel.pTexture == nullptr) continue;
+		if (width == 0)
+		{
+			width = channel.pTexture->m_Width;
+			height = channel.pTexture->m_Height;
+		}
+		else if (channel.pTexture->m_Width != width or channel.pTexture->m_Height != height)
+		{
+			std::cerr << "Texture::CreatePacked > Channel textures differ in size: " << width << "x" << height
+				<< " and " << channel.pTexture->m_Width << "x" << channel.pTexture->m_Height << "\n";
+			throw std::runtime_error("Failed to pack textures");
+		}
+	}
+	if (width == 0) return nullptr;
+
+	// Only the full size level is copied, the packed texture filters its own mip levels
+	constexpr std::array<int, 4> packedShifts{ m_RED_SHIFT, m_GREEN_SHIFT, m_BLUE_SHIFT, m_ALPHA_SHIFT };
+	std::vector<uint32_t> vTexels(static_cast<size_t>(width) * height);
+	for (int y{}; y < height; ++y)
+	{
+		for (int x{}; x < width; ++x)
+		{
+			uint32_t texel{};
+			for (size_t index{}; index < channels.size(); ++index)
+			{
+				const TextureChannel& channel = channels[index];
+				uint32_t value{ channel.fallback };
+				if (channel.pTexture)
+				{
+					const Texture& source = *channel.pTexture;
+					value = (source.m_vTexels[source.TexelIndex(source.m_vMipLevels[0], x, y)] >> channel.shift) & 0xFF;
+				}
+				texel |= value << packedShifts[index];
+			}
+			vTexels[static_cast<size_t>(width) * y + x] = texel;
+		}
+	}
+	return new Texture(width, height, std::move(vTexels));
+}
+Texture* Texture::CreateFromTexels(int width, int height, std::vector<uint32_t>&& vTexels)
+{
+	if (vTexels.size() != static_cast<size_t>(width) * height)
+	{
+		std::cerr << "Texture::CreateFromTexels > Expected " << width << "x" << height << " texels, got " << vTexels.size() << "\n";
+		throw std::runtime_error("Failed to create texture");
+	}
+	return new Texture(width, height, std::move(vTexels));
 }
 
 
@@ -90,43 +194,304 @@ ID3D11ShaderResourceView* Texture::GetSRV() const
 {
 	return m_pSRV;
 }
-ColorRGB Texture::Sample(const Vector2& uv, bool sampleAlpha, float* alpha) const
+ColorRGB Texture::Sample(const Vector2& uv, const UVDerivatives& derivatives, SamplerState samplerState, bool sampleAlpha, float* alpha) const
 {
-	// Set the default return color to black
-	ColorRGB returnColor{ 0, 0, 0 };
+	float sampledAlpha{ 1.f };
+	ColorRGB returnColor{};
+	switch (samplerState)
+	{
+	case SamplerState::Point:
+		returnColor = SamplePoint(uv, sampledAlpha);
+		break;
+	case SamplerState::Linear:
+		// The level of detail follows the longest axis of the pixel
+		returnColor = SampleTrilinear(uv, CalculateLod(std::sqrt(std::max(derivatives.dX.SqrMagnitude(), derivatives.dY.SqrMagnitude()))), sampledAlpha);
+		break;
+	case SamplerState::Anisotropic:
+		returnColor = SampleAnisotropic(uv, derivatives, sampledAlpha);
+		break;
+	}
 
-	// Wrap the UV coordinates
-	float u = uv.x - std::floor(uv.x);
-	float v = uv.y - std::floor(uv.y);
+	if (sampleAlpha and alpha) *alpha = sampledAlpha;
+	return returnColor;
+}
+TextureLayout Texture::GetLayout() const
+{
+	return m_Layout;
+}
+int Texture::GetWidth() const
+{
+	return m_Width;
+}
+int Texture::GetHeight() const
+{
+	return m_Height;
+}
+uint32_t Texture::GetTexel(int x, int y) const
+{
+	return m_vTexels[TexelIndex(m_vMipLevels[0], x, y)];
+}
 
-	// Since our UV coordinates are of values between [0; 1] and SDL requests pixel indexes,
-	// we multiply the UV with width and height of the background
-	int x = static_cast<int>(u * m_pSurface->w);
-	int y = static_cast<int>(v * m_pSurface->h);
 
-	// Bytes per pixel
-	const Uint8 bytesPerPixel = m_pSurface->format->BytesPerPixel;
+//--------------------------------------------------
+//    Mutators
+//--------------------------------------------------
+void Texture::SetLayout(TextureLayout layout)
+{
+	if (layout == m_Layout) return;
 
-	// Retrieve the address of the pixel we need (startAddress + y * width + x * bpp)
-	Uint8* pPixelAddr = reinterpret_cast<Uint8*>(m_pSurfacePixels) + y * m_pSurface->pitch + x * bytesPerPixel;
-	// Convert the pixelAddress to an Uint32, since that is what the SDL_GetRGB expects
-	Uint32 pixelData = *reinterpret_cast<Uint32*>(pPixelAddr);
+	// Every level moves to its own spot in the new layout
+	std::vector<MipLevel> vMipLevels{ m_vMipLevels };
+	size_t texelCount{};
+	for (MipLevel& level : vMipLevels)
+	{
+		level.offset = texelCount;
+		texelCount += TexelCount(level, layout);
+	}
 
-	SDL_Color Color = { 0x00, 0x00, 0x00 };
-	Uint8 sampledAlpha = 0xFF;
+	// Padding texels of the tiled layout are never sampled, they stay 0
+	std::vector<uint32_t> vTexels(texelCount);
+	for (size_t levelIndex{}; levelIndex < m_vMipLevels.size(); ++levelIndex)
+	{
+		const MipLevel& source = m_vMipLevels[levelIndex];
+		const MipLevel& destination = vMipLevels[levelIndex];
+		for (int y{}; y < source.height; ++y)
+			for (int x{}; x < source.width; ++x)
+				vTexels[TexelIndex(destination, layout, x, y)] = m_vTexels[TexelIndex(source, m_Layout, x, y)];
+	}
 
-	// Retrieve the RGB values of the specific pixel
-	SDL_GetRGBA(pixelData, m_pSurface->format, &Color.r, &Color.g, &Color.b, &sampledAlpha);
+	m_vTexels.swap(vTexels);
+	m_vMipLevels.swap(vMipLevels);
+	m_Layout = layout;
+}
+void Texture::ReleaseTexels()
+{
+	std::vector<uint32_t>{}.swap(m_vTexels);
+	m_vMipLevels.clear();
+}
 
-	// Set our returnColor to the color SDL gave us
-	returnColor.r = Color.r;
-	returnColor.g = Color.g;
-	returnColor.b = Color.b;
-	// SDL uses colors in ranges 0-255, we use ranges 0-1, therefore we divide our returnColor by 255
-	returnColor /= 255.f;
 
-	if (sampleAlpha and alpha) *alpha = sampledAlpha / 255.f;
+//--------------------------------------------------
+//    Software Texture Data
+//--------------------------------------------------
+void Texture::ConvertTexels(SDL_Surface* pSurface)
+{
+	// Let SDL convert whatever format the image was loaded in, after this the sampler never needs the SDL format again
+	SDL_Surface* pConverted = SDL_ConvertSurfaceFormat(pSurface, SDL_PIXELFORMAT_ARGB8888, 0);
+	if (pConverted == nullptr)
+	{
+		std::cerr << "Texture::ConvertTexels > Failed to convert texture: " << SDL_GetError() << "\n";
+		throw std::runtime_error("Failed to convert texture");
+	}
+
+	// Drop the row padding
+	m_vTexels.resize(static_cast<size_t>(m_Width) * m_Height);
+	for (int y{}; y < m_Height; ++y)
+	{
+		const uint32_t* pRow = reinterpret_cast<const uint32_t*>(static_cast<const Uint8*>(pConverted->pixels) + y * pConverted->pitch);
+		std::copy_n(pRow, m_Width, &m_vTexels[static_cast<size_t>(m_Width) * y]);
+	}
 
-	// return the background color of the pixel
+	SDL_FreeSurface(pConverted);
+}
+void Texture::GenerateMipLevels()
+{
+	// Filtered in the linear layout, the texture is only tiled after all levels exist
+	// Level 0 is the texture itself, every next level halves it (rounding down) until 1x1
+	m_vMipLevels.clear();
+	MipLevel level{ m_Width, m_Height };
+	size_t texelCount{};
+	while (true)
+	{
+		level.wrapMaskX = std::has_single_bit(static_cast<unsigned>(level.width)) ? level.width - 1 : 0;
+		level.wrapMaskY = std::has_single_bit(static_cast<unsigned>(level.height)) ? level.height - 1 : 0;
+		level.blocksPerRow = (level.width + m_TILE_SIZE - 1) / m_TILE_SIZE;
+		level.offset = texelCount;
+		m_vMipLevels.push_back(level);
+		texelCount += static_cast<size_t>(level.width) * level.height;
+
+		if (level.width == 1 and level.height == 1) break;
+		level.width = std::max(level.width / 2, 1);
+		level.height = std::max(level.height / 2, 1);
+	}
+	m_vTexels.resize(texelCount);
+
+	// 2x2 box filter of the previous level, the rows of a level are filtered in parallel
+	std::vector<int> rowIndices(m_Height);
+	std::iota(rowIndices.begin(), rowIndices.end(), 0);
+	for (size_t levelIndex{ 1 }; levelIndex < m_vMipLevels.size(); ++levelIndex)
+	{
+		const MipLevel& source = m_vMipLevels[levelIndex - 1];
+		const MipLevel& destination = m_vMipLevels[levelIndex];
+		std::for_each(std::execution::par, rowIndices.begin(), rowIndices.begin() + destination.height, [&](int y)
+			{
+				// Odd sizes just repeat the last row / column
+				const uint32_t* pRow0 = &m_vTexels[source.offset + static_cast<size_t>(source.width) * (2 * y)];
+				const uint32_t* pRow1 = &m_vTexels[source.offset + static_cast<size_t>(source.width) * std::min(2 * y + 1, source.height - 1)];
+				uint32_t* pDestination = &m_vTexels[destination.offset + static_cast<size_t>(destination.width) * y];
+
+				for (int x{}; x < destination.width; ++x)
+				{
+					const int x0 = 2 * x;
+					const int x1 = std::min(2 * x + 1, source.width - 1);
+					uint32_t texel{};
+					for (int shift{}; shift < 32; shift += 8)
+					{
+						const uint32_t sum = ((pRow0[x0] >> shift) & 0xFF) + ((pRow0[x1] >> shift) & 0xFF)
+										   + ((pRow1[x0] >> shift) & 0xFF) + ((pRow1[x1] >> shift) & 0xFF);
+						texel |= ((sum + 2) / 4) << shift;
+					}
+					pDestination[x] = texel;
+				}
+			});
+	}
+}
+ColorRGB Texture::SamplePoint(const Vector2& uv, float& alpha) const
+{
+	// Nearest texel of the full size level, like the hardware sampler (its textures have no mip levels)
+	const MipLevel& level = m_vMipLevels[0];
+	const int x = WrapCoordinate(uv.x, level.width, level.wrapMaskX);
+	const int y = WrapCoordinate(uv.y, level.height, level.wrapMaskY);
+	const uint32_t texel = m_vTexels[TexelIndex(level, x, y)];
+
+	// Texels are 0-255 per channel, we use ranges 0-1
+	alpha = UNORM8_TO_FLOAT[texel >> 24];
+	return ColorRGB{ UNORM8_TO_FLOAT[(texel >> 16) & 0xFF], UNORM8_TO_FLOAT[(texel >> 8) & 0xFF], UNORM8_TO_FLOAT[texel & 0xFF] };
+}
+ColorRGB Texture::SampleTrilinear(const Vector2& uv, float lod, float& alpha) const
+{
+	// Blend the bilinear samples of the two closest levels
+	const int level = static_cast<int>(lod);
+	const float levelBlend = lod - static_cast<float>(level);
+
+	ColorRGB returnColor = SampleBilinear(m_vMipLevels[level], uv, alpha);
+	if (levelBlend > 0.f)
+	{
+		float nextAlpha{};
+		const ColorRGB nextColor = SampleBilinear(m_vMipLevels[level + 1], uv, nextAlpha);
+		returnColor = ColorRGB::Lerp(returnColor, nextColor, levelBlend);
+		alpha = Lerpf(alpha, nextAlpha, levelBlend);
+	}
 	return returnColor;
 }
+ColorRGB Texture::SampleAnisotropic(const Vector2& uv, const UVDerivatives& derivatives, float& alpha) const
+{
+	// The pixel covers a stretched footprint: take (at most m_MAX_ANISOTROPY) trilinear taps along its longest axis,
+	// every tap only has to filter the shortest axis (or the part of the longest axis between two taps)
+	const float lengthX = derivatives.dX.Magnitude();
+	const float lengthY = derivatives.dY.Magnitude();
+	const Vector2& majorAxis = lengthX > lengthY ? derivatives.dX : derivatives.dY;
+	const float majorLength = std::max(lengthX, lengthY);
+	const float minorLength = std::min(lengthX, lengthY);
+
+	int tapCount{ 1 };
+	if (majorLength > minorLength * m_MAX_ANISOTROPY)	tapCount = m_MAX_ANISOTROPY;
+	else if (minorLength > 0.f)							tapCount = static_cast<int>(std::ceil(majorLength / minorLength));
+	const float lod = CalculateLod(majorLength / static_cast<float>(tapCount));
+
+	// Taps are spread evenly over the longest axis, centered on the pixel
+	ColorRGB returnColor{};
+	alpha = 0.f;
+	for (int tap{}; tap < tapCount; ++tap)
+	{
+		const float offset = (static_cast<float>(tap) + 0.5f) / static_cast<float>(tapCount) - 0.5f;
+		float tapAlpha{};
+		returnColor += SampleTrilinear(uv + majorAxis * offset, lod, tapAlpha);
+		alpha += tapAlpha;
+	}
+
+	const float invTapCount = 1.f / static_cast<float>(tapCount);
+	alpha *= invTapCount;
+	return returnColor * invTapCount;
+}
+ColorRGB Texture::SampleBilinear(const MipLevel& level, const Vector2& uv, float& alpha) const
+{
+	// Texel centers are at .5, so the four texels around the sample point start half a texel to the top left
+	const float x = uv.x * level.width - 0.5f;
+	const float y = uv.y * level.height - 0.5f;
+	const float floorX = std::floor(x);
+	const float floorY = std::floor(y);
+	const float blendX = x - floorX;
+	const float blendY = y - floorY;
+
+	const int x0 = WrapTexel(static_cast<int>(floorX), level.width, level.wrapMaskX);
+	const int y0 = WrapTexel(static_cast<int>(floorY), level.height, level.wrapMaskY);
+	const int x1 = WrapTexel(x0 + 1, level.width, level.wrapMaskX);
+	const int y1 = WrapTexel(y0 + 1, level.height, level.wrapMaskY);
+
+	const uint32_t texels[4]{
+		m_vTexels[TexelIndex(level, x0, y0)], m_vTexels[TexelIndex(level, x1, y0)],
+		m_vTexels[TexelIndex(level, x0, y1)], m_vTexels[TexelIndex(level, x1, y1)] };
+	const float weights[4]{
+		(1.f - blendX) * (1.f - blendY), blendX * (1.f - blendY),
+		(1.f - blendX) * blendY, blendX * blendY };
+
+#if defined(__SSE2__) || defined(_M_X64)
+	// One texel per register (SSE2, so every x64 CPU runs it), all channels of the four texels are weighted and summed at once
+	const __m128i zero = _mm_setzero_si128();
+	const auto texel = [&](int index)
+		{
+			const __m128i bytes = _mm_cvtsi32_si128(static_cast<int>(texels[index]));
+			return _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, zero), zero)), _mm_set1_ps(weights[index]));
+		};
+	const __m128 sum = _mm_add_ps(_mm_add_ps(texel(0), texel(2)), _mm_add_ps(texel(1), texel(3)));
+	const __m128 channels = _mm_mul_ps(sum, _mm_set1_ps(1.f / 255.f));
+
+	// Little endian 0xAARRGGBB: blue is the first byte
+	alignas(16) float bgra[4]{};
+	_mm_store_ps(bgra, channels);
+	alpha = bgra[3];
+	return ColorRGB{ bgra[2], bgra[1], bgra[0] };
+#else
+	// Same order of operations as the SSE2 path
+	const auto filterChannel = [&](int shift)
+		{
+			const auto channel = [&](int index) { return weights[index] * static_cast<float>((texels[index] >> shift) & 0xFF); };
+			return ((channel(0) + channel(2)) + (channel(1) + channel(3))) * (1.f / 255.f);
+		};
+	alpha = filterChannel(24);
+	return ColorRGB{ filterChannel(16), filterChannel(8), filterChannel(0) };
+#endif
+}
+float Texture::CalculateLod(float uvSize) const
+{
+	// The size of the pixel in texels of the full size level, as a (clamped) mip level. Also catches NaNs
+	const float lod = std::log2(uvSize) + m_Log2Size;
+	if (!(lod > 0.f)) return 0.f;
+	return std::min(lod, static_cast<float>(m_vMipLevels.size() - 1));
+}
+int Texture::WrapCoordinate(float coordinate, int size, int wrapMask)
+{
+	// Power of two sizes wrap with a single mask, which also works for negative coordinates
+	if (wrapMask) return static_cast<int>(std::floor(coordinate * size)) & wrapMask;
+
+	// Otherwise wrap to [0, 1) first, the min keeps a coordinate just below 1 from rounding up to size
+	return std::min(static_cast<int>((coordinate - std::floor(coordinate)) * size), size - 1);
+}
+int Texture::WrapTexel(int texel, int size, int wrapMask)
+{
+	// Power of two sizes wrap with a single mask, which also works for negative texels
+	if (wrapMask) return texel & wrapMask;
+	texel %= size;
+	return texel < 0 ? texel + size : texel;
+}
+size_t Texture::TexelIndex(const MipLevel& level, int x, int y) const
+{
+	return TexelIndex(level, m_Layout, x, y);
+}
+size_t Texture::TexelIndex(const MipLevel& level, TextureLayout layout, int x, int y)
+{
+	if (layout == TextureLayout::Linear) return level.offset + static_cast<size_t>(level.width) * y + x;
+
+	// Walking down a column stays in the same cache line for a whole tile, instead of a new line every texel
+	const size_t tile = static_cast<size_t>(level.blocksPerRow) * (y >> m_LOG2_TILE_SIZE) + (x >> m_LOG2_TILE_SIZE);
+	const int texelInTile = ((y & (m_TILE_SIZE - 1)) << m_LOG2_TILE_SIZE) + (x & (m_TILE_SIZE - 1));
+	return level.offset + tile * (m_TILE_SIZE * m_TILE_SIZE) + texelInTile;
+}
+size_t Texture::TexelCount(const MipLevel& level, TextureLayout layout)
+{
+	if (layout == TextureLayout::Linear) return static_cast<size_t>(level.width) * level.height;
+
+	const int blocksPerColumn = (level.height + m_TILE_SIZE - 1) / m_TILE_SIZE;
+	return static_cast<size_t>(level.blocksPerRow) * blocksPerColumn * (m_TILE_SIZE * m_TILE_SIZE);
+}
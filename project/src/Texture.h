@@ -1,11 +1,31 @@
 #pragma once
 #include "pch.h"
 #include <SDL_surface.h>
+#include <array>
 #include <string>
+#include <vector>
 #include "ColorRGB.h"
+#include "RenderStates.h"
 
 using namespace dae;
 
+// Screen space derivatives of the uv coordinates, the part of the texture a pixel covers
+struct UVDerivatives
+{
+	Vector2 dX{};
+	Vector2 dY{};
+};
+
+class Texture;
+
+// One channel of a packed texture, taken from a channel of another texture
+struct TextureChannel
+{
+	const Texture* pTexture{};
+	int shift{};		// of the channel in the 0xAARRGGBB source texels
+	uint8_t fallback{};	// value of the channel without a texture
+};
+
 class Texture final
 {
 public:
@@ -23,24 +43,82 @@ public:
 	//    Texture Loader
 	//--------------------------------------------------
 	static Texture* LoadFromFile(const std::string& path, ID3D11Device* pDevice = nullptr);
+	// Software only texture with red, green, blue and alpha taken from the given channels (of textures of the same size)
+	static Texture* CreatePacked(const std::array<TextureChannel, 4>& channels);
+	// Software only texture from 0xAARRGGBB texels, row after row
+	static Texture* CreateFromTexels(int width, int height, std::vector<uint32_t>&& vTexels);
+
+	// Position of the channels in the packed texels
+	static constexpr int m_RED_SHIFT{ 16 };
+	static constexpr int m_GREEN_SHIFT{ 8 };
+	static constexpr int m_BLUE_SHIFT{ 0 };
+	static constexpr int m_ALPHA_SHIFT{ 24 };
 
 	//--------------------------------------------------
 	//    Accessors
 	//--------------------------------------------------
 	ID3D11ShaderResourceView* GetSRV() const;
-	ColorRGB Sample(const Vector2& uv, bool sampleAlpha = false, float* alpha = nullptr) const;
+	ColorRGB Sample(const Vector2& uv, const UVDerivatives& derivatives, SamplerState samplerState, bool sampleAlpha = false, float* alpha = nullptr) const;
+	TextureLayout GetLayout() const;
+	int GetWidth() const;
+	int GetHeight() const;
+	// Unfiltered 0xAARRGGBB texel of the full size level
+	uint32_t GetTexel(int x, int y) const;
+
+	//--------------------------------------------------
+	//    Mutators
+	//--------------------------------------------------
+	void SetLayout(TextureLayout layout);
+	// Frees the software copy, for textures only the GPU still samples
+	void ReleaseTexels();
 
 private:
 	//--------------------------------------------------
 	//    Constructor
 	//--------------------------------------------------
 	Texture(SDL_Surface* pSurface, ID3D11Device* pDevice);
+	Texture(int width, int height, std::vector<uint32_t>&& vTexels);
+
+	struct MipLevel
+	{
+		int width{};
+		int height{};
+		int wrapMaskX{};	// size - 1 if the size is a power of two, 0 otherwise
+		int wrapMaskY{};
+		int blocksPerRow{};	// tiled layout only, rows are padded to whole blocks
+		size_t offset{};	// first texel of the level in m_vTexels
+	};
+
+	void ConvertTexels(SDL_Surface* pSurface);
+	void GenerateMipLevels();
+
+	ColorRGB SamplePoint(const Vector2& uv, float& alpha) const;
+	ColorRGB SampleTrilinear(const Vector2& uv, float lod, float& alpha) const;
+	ColorRGB SampleAnisotropic(const Vector2& uv, const UVDerivatives& derivatives, float& alpha) const;
+	ColorRGB SampleBilinear(const MipLevel& level, const Vector2& uv, float& alpha) const;
+	float CalculateLod(float uvSize) const;
+	static int WrapCoordinate(float coordinate, int size, int wrapMask);
+	static int WrapTexel(int texel, int size, int wrapMask);
+	size_t TexelIndex(const MipLevel& level, int x, int y) const;
+	static size_t TexelIndex(const MipLevel& level, TextureLayout layout, int x, int y);
+	static size_t TexelCount(const MipLevel& level, TextureLayout layout);
+
+	// Same as the default of the hardware sampler
+	static constexpr int m_MAX_ANISOTROPY{ 16 };
+	// Side of a tile in texels, 4x4 ARGB texels are exactly one 64 byte cache line
+	static constexpr int m_TILE_SIZE{ 4 };
+	static constexpr int m_LOG2_TILE_SIZE{ 2 };
 
 	//--------------------------------------------------
 	//    Texture Data
 	//--------------------------------------------------
-	SDL_Surface* m_pSurface{ nullptr };
-	uint32_t* m_pSurfacePixels{ nullptr };
+	// Software copy, converted once at load to tightly packed 0xAARRGGBB texels, followed by all its mip levels
+	std::vector<uint32_t> m_vTexels{};
+	std::vector<MipLevel> m_vMipLevels{};
+	TextureLayout m_Layout{ TextureLayout::Linear };
+	int m_Width{};
+	int m_Height{};
+	float m_Log2Size{};
 
 	//--------------------------------------------------
 	//    DirectX Data
@@ -1,201 +1,475 @@
 #pragma once
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cstring>
+#include <execution>
+#include <filesystem>
 #include <fstream>
+#include <numeric>
+#include <queue>
+#include <string_view>
+#include <thread>
+#include <tuple>
 #include "Math.h"
 #include "Renderer.h"
 #include "RenderStates.h"
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace dae
 {
-	inline bool HaveSameSign(float val1, float val2, float val3)
+	inline float InterpolateDepth(float Z0, float Z1, float Z2, const Vector3& weights)
 	{
-		return std::signbit(val1) == std::signbit(val2) && std::signbit(val2) == std::signbit(val3);
+		return (Z0 * Z1 * Z2)
+			/ (weights.x * Z1 * Z2 + weights.y * Z0 * Z2 + weights.z * Z0 * Z1);
 	}
 
+	// Stores the plane of attribute / w for the first componentCount components of an attribute, starting at offset
 	template<typename AttributeType>
-	inline AttributeType InterpolateAttribute(const AttributeType& data0, const AttributeType& data1, const AttributeType& data2,
-		float Z0, float Z1, float Z2, float interpolatedDepth,
-		const Vector3& weights)
+	inline void SetAttributePlane(AttributePlanes& planes, int offset, int componentCount,
+		const AttributeType& data0, const AttributeType& data1, const AttributeType& data2, const Vector3& invW)
 	{
-		return (data0 * weights.x * Z1 * Z2 + data1 * weights.y * Z0 * Z2 + data2 * weights.z * Z0 * Z1)
-			/ (Z0 * Z1 * Z2) * interpolatedDepth;
+		for (int component{}; component < componentCount; ++component)
+		{
+			const float base = data0[component] * invW.x;
+			planes.base[offset + component] = base;
+			planes.delta1[offset + component] = data1[component] * invW.y - base;
+			planes.delta2[offset + component] = data2[component] * invW.z - base;
+		}
+	}
+	inline float EvaluateAttributePlane(const AttributePlanes& planes, int index, const Vector3& weights)
+	{
+		return planes.base[index] + weights.y * planes.delta1[index] + weights.z * planes.delta2[index];
 	}
 
-	inline float InterpolateDepth(float Z0, float Z1, float Z2, const Vector3& weights)
+	// Sub-pixel precision of the fixed point screen positions the edge functions work with
+	constexpr int SUBPIXEL_BITS = 8;
+	constexpr int SUBPIXEL_ONE = 1 << SUBPIXEL_BITS;
+	constexpr int SUBPIXEL_HALF = SUBPIXEL_ONE / 2;
+
+	// Snaps a SCREEN SPACE position to the fixed point sub-pixel grid
+	inline Int2 ToFixedPoint(const Vector2& screenPosition)
 	{
-		return (Z0 * Z1 * Z2)
-			/ (weights.x * Z1 * Z2 + weights.y * Z0 * Z2 + weights.z * Z0 * Z1);
+		return { static_cast<int>(std::lround(screenPosition.x * SUBPIXEL_ONE)),
+				 static_cast<int>(std::lround(screenPosition.y * SUBPIXEL_ONE)) };
 	}
 
-	// Both pixel and the triangle vertices must be in SCREEN SPACE
-	inline Vector3 CalculateBarycentricCoordinates(const Vector2& v0, const Vector2& v1, const Vector2& v2, const Vector2& p, float invArea)
-	{
-		// Calculate the barycentric coordinates
-		// the if-checks and early return statements are to prevent further computing once one of the weights is outside the -1 - 1 range
-		// Since at that point, our pixel is 100% going to be outside the triangle
-		// If this is the case, we return the barycentric {0, 0, 0}, which will immediately get discarded by the AreBarycentricValid function
-		float u = Vector2::Cross(v1 - p, v2 - v1) * invArea;
-		if (u < -1 or u > 1) return { 1,-1,1 }; // return invalid weights
-		float v = Vector2::Cross(v2 - p, v0 - v2) * invArea;
-		if (v < -1 or v > 1) return { 1,-1,1 }; // return invalid weights
-		float w = Vector2::Cross(v0 - p, v1 - v0) * invArea;
-		if (w < -1 or w > 1) return { 1,-1,1 }; // return invalid weights
-
-		return { u, v, w };
+	// Edge function of the edge from a to b, in fixed point
+	// E(p) is the same as Vector2::Cross(a - p, b - a), so (divided by the triangle area) it is the barycentric weight of the opposite vertex
+	inline EdgeFunction CreateEdgeFunction(const Int2& a, const Int2& b)
+	{
+		EdgeFunction edge{};
+		edge.a = static_cast<int64_t>(a.y) - b.y;
+		edge.b = static_cast<int64_t>(b.x) - a.x;
+		edge.c = -(edge.a * a.x + edge.b * a.y);
+		return edge;
 	}
-	inline bool AreBarycentricValid(Vector3& barycentric)
+	inline int64_t EvaluateEdgeFunction(const EdgeFunction& edge, const Int2& p)
 	{
-		// If they differ from sign, already return false
-		if (!HaveSameSign(barycentric.x, barycentric.y, barycentric.z)) return false;
-
-		// Create simpler aliases
-		const float X = barycentric.x = abs(barycentric.x);
-		const float Y = barycentric.y = abs(barycentric.y);
-		const float Z = barycentric.z = abs(barycentric.z);
+		return edge.a * p.x + edge.b * p.y + edge.c;
+	}
+	// With the inside of the triangle positive and y pointing down:
+	// a left edge increases towards the right (A > 0), a top edge is horizontal and increases downwards (A == 0, B > 0)
+	inline bool IsTopLeftEdge(const EdgeFunction& edge)
+	{
+		return edge.a > 0 or (edge.a == 0 and edge.b > 0);
+	}
 
-		// Do a quick check to immediately discard if the sum doesn't equal 1
-		if (!AreEqual(X + Y + Z, 1, 0.0001f)) return false;
+	// The software framebuffer is always SDL_PIXELFORMAT_RGB888 (0x00RRGGBB), colors are expected in the 0-1 range
+	inline uint32_t PackColor(const ColorRGB& color)
+	{
+		const uint32_t r = static_cast<uint32_t>(std::clamp(static_cast<int>(color.r * 255), 0, 255));
+		const uint32_t g = static_cast<uint32_t>(std::clamp(static_cast<int>(color.g * 255), 0, 255));
+		const uint32_t b = static_cast<uint32_t>(std::clamp(static_cast<int>(color.b * 255), 0, 255));
+		return (r << 16) | (g << 8) | b;
+	}
+	inline ColorRGB UnpackColor(uint32_t pixel)
+	{
+		return ColorRGB{ static_cast<float>((pixel >> 16) & 0xFF), static_cast<float>((pixel >> 8) & 0xFF), static_cast<float>(pixel & 0xFF) } / 255.f;
+	}
+#if defined(AVX2_KERNELS)
+	// PackColor for 8 colors at once, truncates the same way the scalar cast does
+	AVX2_TARGET inline __m256i PackColors(const __m256& r, const __m256& g, const __m256& b)
+	{
+		const __m256 scale = _mm256_set1_ps(255.f);
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i full = _mm256_set1_epi32(255);
+		const __m256i r8 = _mm256_min_epi32(_mm256_max_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(r, scale)), zero), full);
+		const __m256i g8 = _mm256_min_epi32(_mm256_max_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(g, scale)), zero), full);
+		const __m256i b8 = _mm256_min_epi32(_mm256_max_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(b, scale)), zero), full);
+		return _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(r8, 16), _mm256_slli_epi32(g8, 8)), b8);
+	}
+	// Packs all 8 colors at once, only storing the pixels in the mask (bit i is pixel i)
+	AVX2_TARGET inline void StorePackedColors(uint32_t* pPixels, const float* r, const float* g, const float* b, int mask)
+	{
+		const __m256i laneBits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+		const __m256i write = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(mask), laneBits), laneBits);
+		const __m256i packed = PackColors(_mm256_load_ps(r), _mm256_load_ps(g), _mm256_load_ps(b));
+		_mm256_maskstore_epi32(reinterpret_cast<int*>(pPixels), write, packed);
+	}
+#endif
 
-		return true;
+	// Triangles are only clipped against the x/y planes when they leave this NDC range, anything within it is rasterized
+	// directly and clamped to the screen by its bounding box. It keeps the fixed point edge functions far from overflowing
+	constexpr float GUARD_BAND = 8.f;
 
+	// Post-transform vertex cache size the index order is optimized for, small enough to also suit older GPUs
+	constexpr int VERTEX_CACHE_SIZE = 16;
 
-		// Below code not needed anymore as I already check if the weights have the same sign and their absolutes add up to 1.
-		// Mathematically speaking, this must mean their absolute values must be between 0-1.
-		// Check if they are within the valid range of 0-1
-		//if (X < 0.f or X > 1.f) return false;
-		//if (Y < 0.f or Y > 1.f) return false;
-		//if (Z < 0.f or Z > 1.f) return false;
+	// Version of the binary mesh cache, bump it whenever the parsing or optimizing of meshes changes their data
+	constexpr uint32_t MESH_CACHE_VERSION = 3;
 
-	}
+	// Every LOD of a mesh has at most this fraction of the triangles of the one before it, the chain ends when the simplifier
+	// cannot get there anymore within the error budget (a fraction of the mesh radius)
+	constexpr int MESH_LOD_COUNT = 6;
+	constexpr float MESH_LOD_TRIANGLE_RATIO = 0.7f;
+	constexpr float MESH_LOD_MAX_ERROR = 0.05f;
 
-	inline bool IsNDCTriangleInFrustum(const Vertex& vertex)
+	// Homogeneous clip planes, with the D3D depth range (0 <= z <= w)
+	enum ClipPlane : uint8_t
 	{
-		const Vector3& positionNDC = vertex.position;
+		CLIP_NEAR	= 1 << 0,
+		CLIP_FAR	= 1 << 1,
+		CLIP_LEFT	= 1 << 2,
+		CLIP_RIGHT	= 1 << 3,
+		CLIP_BOTTOM	= 1 << 4,
+		CLIP_TOP	= 1 << 5,
+	};
+	constexpr int CLIP_PLANE_COUNT = 6;
 
-		if (positionNDC.x < -1 or positionNDC.x > 1) return false;
-		if (positionNDC.y < -1 or positionNDC.y > 1) return false;
-		if (positionNDC.z < 0 or positionNDC.z > 1) return false;
-		return true;
+	// Signed distance of a CLIP SPACE position to a clip plane, positive inside
+	inline float ClipPlaneDistance(const Vector4& position, int planeIndex)
+	{
+		switch (planeIndex)
+		{
+		case 0: return position.z;
+		case 1: return position.w - position.z;
+		case 2: return position.x + GUARD_BAND * position.w;
+		case 3: return GUARD_BAND * position.w - position.x;
+		case 4: return position.y + GUARD_BAND * position.w;
+		default: return GUARD_BAND * position.w - position.y;
+		}
 	}
-	inline bool IsNDCTriangleInFrustum(const VertexOut& vertex)
+
+	// One bit per clip plane the CLIP SPACE position is outside of
+	inline uint8_t CalculateClipFlags(const Vector4& position)
 	{
-		Vertex temp;
-		temp.position = vertex.position.GetXYZ();
-		temp.color = vertex.color;
-		temp.uv = vertex.uv;
+		uint8_t flags{};
+		for (int planeIndex{}; planeIndex < CLIP_PLANE_COUNT; ++planeIndex)
+		{
+			if (ClipPlaneDistance(position, planeIndex) < 0) flags |= 1 << planeIndex;
+		}
+		return flags;
+	}
 
-		return IsNDCTriangleInFrustum(temp);
+	// Linear interpolation of every attribute, only correct in CLIP SPACE (before the perspective divide)
+	inline VertexOut LerpVertex(const VertexOut& v0, const VertexOut& v1, float t)
+	{
+		VertexOut result{};
+		result.position = v0.position + (v1.position - v0.position) * t;
+		result.worldPos = v0.worldPos + (v1.worldPos - v0.worldPos) * t;
+		result.color = v0.color + (v1.color - v0.color) * t;
+		result.uv = v0.uv + (v1.uv - v0.uv) * t;
+		result.normal = v0.normal + (v1.normal - v0.normal) * t;
+		result.tangent = v0.tangent + (v1.tangent - v0.tangent) * t;
+		return result;
 	}
 
 	namespace Utils
 	{
-		//Just parses vertices and indices
-#pragma warning(push)
-#pragma warning(disable : 4505) //Warning unreferenced local function
-		static bool ParseOBJ(const std::string& filename, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, bool flipAxisAndWinding = true)
+		// Read only view of a whole file, the OS pages it in on demand instead of it being copied into a buffer
+		class MappedFile final
 		{
-			std::ifstream file(filename);
-			if (!file)
-				return false;
+		public:
+			explicit MappedFile(const std::string& filename)
+			{
+#if defined(_WIN32)
+				m_File = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+				if (m_File == INVALID_HANDLE_VALUE) return;
+				LARGE_INTEGER size{};
+				if (!GetFileSizeEx(m_File, &size)) return;
+				m_Size = static_cast<size_t>(size.QuadPart);
+				m_IsOpen = true;
+				// An empty file can not be mapped, but is a valid (empty) view
+				if (m_Size == 0) return;
+
+				m_Mapping = CreateFileMappingA(m_File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+				if (m_Mapping != nullptr) m_pData = static_cast<const char*>(MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+				const int file = open(filename.c_str(), O_RDONLY);
+				if (file < 0) return;
+				struct stat status{};
+				if (fstat(file, &status) == 0)
+				{
+					m_Size = static_cast<size_t>(status.st_size);
+					m_IsOpen = true;
+					if (m_Size > 0)
+					{
+						void* pMapped = mmap(nullptr, m_Size, PROT_READ, MAP_PRIVATE, file, 0);
+						if (pMapped != MAP_FAILED)
+						{
+							// The whole file is about to be read by several threads at once
+							madvise(pMapped, m_Size, MADV_WILLNEED);
+							m_pData = static_cast<const char*>(pMapped);
+						}
+					}
+				}
+				// The mapping stays valid without the descriptor
+				close(file);
+#endif
+				if (m_Size > 0 and m_pData == nullptr) m_IsOpen = false;
+			}
+			~MappedFile()
+			{
+#if defined(_WIN32)
+				if (m_pData) UnmapViewOfFile(m_pData);
+				if (m_Mapping) CloseHandle(m_Mapping);
+				if (m_File != INVALID_HANDLE_VALUE) CloseHandle(m_File);
+#else
+				if (m_pData) munmap(const_cast<char*>(m_pData), m_Size);
+#endif
+			}
+
+			MappedFile(const MappedFile&) = delete;
+			MappedFile(MappedFile&&) noexcept = delete;
+			MappedFile& operator=(const MappedFile&) = delete;
+			MappedFile& operator=(MappedFile&&) noexcept = delete;
+
+			bool IsOpen() const { return m_IsOpen; }
+			std::string_view GetView() const { return { m_pData, m_pData ? m_Size : 0 }; }
 
+		private:
+			const char* m_pData{ nullptr };
+			size_t m_Size{};
+			bool m_IsOpen{ false };
+#if defined(_WIN32)
+			HANDLE m_File{ INVALID_HANDLE_VALUE };
+			HANDLE m_Mapping{ nullptr };
+#endif
+		};
+
+		// One face corner, with the 1-based OBJ indices (0 when the uv or normal is left out)
+		struct OBJCorner
+		{
+			int position{};
+			int uv{};
+			int normal{};
+
+			bool operator==(const OBJCorner&) const = default;
+		};
+		// Everything one range of lines declares, the corners are already triangulated
+		struct OBJChunk
+		{
 			std::vector<Vector3> positions{};
 			std::vector<Vector3> normals{};
 			std::vector<Vector2> UVs{};
+			std::vector<OBJCorner> corners{};
+			bool malformed{ false };
+		};
 
-			vertices.clear();
-			indices.clear();
-
-			std::string sCommand;
-			// start a while iteration ending when the end of file is reached (ios::eof)
-			while (!file.eof())
+#pragma warning(push)
+#pragma warning(disable : 4505) //Warning unreferenced local function
+		static uint64_t HashOBJCorner(const OBJCorner& corner)
+		{
+			// The indices are small and dense, spreading them with large primes is enough
+			return (static_cast<uint64_t>(corner.position) * 73856093u) ^ (static_cast<uint64_t>(corner.uv) * 19349663u) ^ (static_cast<uint64_t>(corner.normal) * 83492791u);
+		}
+		static const char* SkipSpaces(const char* pCurrent, const char* pEnd)
+		{
+			while (pCurrent < pEnd and (*pCurrent == ' ' or *pCurrent == '\t')) ++pCurrent;
+			return pCurrent;
+		}
+		// Returns nullptr when there is no number
+		template<typename NumberType>
+		static const char* ParseNumber(const char* pCurrent, const char* pEnd, NumberType& value)
+		{
+			pCurrent = SkipSpaces(pCurrent, pEnd);
+			// from_chars does not accept an explicit plus sign
+			if (pCurrent < pEnd and *pCurrent == '+') ++pCurrent;
+			const auto [pNext, error] = std::from_chars(pCurrent, pEnd, value);
+			return error == std::errc{} ? pNext : nullptr;
+		}
+		// Parses the corners of a face as a triangle fan, false if it is malformed
+		static bool ParseOBJFace(const char* pCurrent, const char* pEnd, std::vector<OBJCorner>& corners)
+		{
+			OBJCorner first{};
+			OBJCorner previous{};
+			int cornerCount{};
+			while ((pCurrent = SkipSpaces(pCurrent, pEnd)) < pEnd)
 			{
-				//read the first word of the string, use the >> operator (istream::operator>>) 
-				file >> sCommand;
-				//use conditional statements to process the different commands	
-				if (sCommand == "#")
+				OBJCorner corner{};
+				pCurrent = ParseNumber(pCurrent, pEnd, corner.position);
+				if (pCurrent == nullptr) return false;
+				if (pCurrent < pEnd and *pCurrent == '/')
 				{
-					// Ignore Comment
+					// Optional texture coordinate
+					if (++pCurrent < pEnd and *pCurrent != '/')
+					{
+						pCurrent = ParseNumber(pCurrent, pEnd, corner.uv);
+						if (pCurrent == nullptr) return false;
+					}
+					// Optional vertex normal
+					if (pCurrent < pEnd and *pCurrent == '/')
+					{
+						pCurrent = ParseNumber(pCurrent + 1, pEnd, corner.normal);
+						if (pCurrent == nullptr) return false;
+					}
 				}
-				else if (sCommand == "v")
-				{
-					//Vertex
-					float x, y, z;
-					file >> x >> y >> z;
 
-					positions.emplace_back(x, y, z);
-				}
-				else if (sCommand == "vt")
+				if (cornerCount == 0) first = corner;
+				else if (cornerCount >= 2) corners.insert(corners.end(), { first, previous, corner });
+				previous = corner;
+				++cornerCount;
+			}
+			return cornerCount >= 3;
+		}
+		// Parses whole lines only, pBegin has to be at the start of one
+		static void ParseOBJChunk(const char* pBegin, const char* pEnd, OBJChunk& chunk)
+		{
+			for (const char* pLine{ pBegin }; pLine < pEnd;)
+			{
+				const char* pNewLine = static_cast<const char*>(std::memchr(pLine, '\n', pEnd - pLine));
+				const char* pLineEnd = pNewLine ? pNewLine : pEnd;
+				const char* pNextLine = pNewLine ? pNewLine + 1 : pEnd;
+				if (pLineEnd > pLine and pLineEnd[-1] == '\r') --pLineEnd;
+
+				const char* pCurrent = SkipSpaces(pLine, pLineEnd);
+				const char* pCommandEnd = pCurrent;
+				while (pCommandEnd < pLineEnd and *pCommandEnd != ' ' and *pCommandEnd != '\t') ++pCommandEnd;
+				const std::string_view command{ pCurrent, static_cast<size_t>(pCommandEnd - pCurrent) };
+				pLine = pNextLine;
+
+				// Anything after the expected values (like a w component) is ignored, as are unknown commands and comments
+				if (command == "v" or command == "vn")
 				{
-					// Vertex TexCoord
-					float u, v;
-					file >> u >> v;
-					UVs.emplace_back(u, 1 - v);
+					Vector3 value{};
+					const char* pValue = ParseNumber(pCommandEnd, pLineEnd, value.x);
+					if (pValue) pValue = ParseNumber(pValue, pLineEnd, value.y);
+					if (pValue) pValue = ParseNumber(pValue, pLineEnd, value.z);
+					if (pValue == nullptr) chunk.malformed = true;
+					(command == "v" ? chunk.positions : chunk.normals).push_back(value);
 				}
-				else if (sCommand == "vn")
+				else if (command == "vt")
 				{
-					// Vertex Normal
-					float x, y, z;
-					file >> x >> y >> z;
-
-					normals.emplace_back(x, y, z);
+					Vector2 value{};
+					const char* pValue = ParseNumber(pCommandEnd, pLineEnd, value.x);
+					if (pValue) pValue = ParseNumber(pValue, pLineEnd, value.y);
+					if (pValue == nullptr) chunk.malformed = true;
+					chunk.UVs.emplace_back(value.x, 1 - value.y);
 				}
-				else if (sCommand == "f")
+				else if (command == "f")
 				{
-					//if a face is read:
-					//construct the 3 vertices, add them to the vertex array
-					//add three indices to the index array
-					//add the material index as attribute to the attribute array
-					//
-					// Faces or triangles
-					Vertex vertex{};
-					size_t iPosition, iTexCoord, iNormal;
+					if (!ParseOBJFace(pCommandEnd, pLineEnd, chunk.corners)) chunk.malformed = true;
+				}
+			}
+		}
 
-					uint32_t tempIndices[3];
-					for (size_t iFace = 0; iFace < 3; iFace++)
-					{
-						// OBJ format uses 1-based arrays
-						file >> iPosition;
-						vertex.position = positions[iPosition - 1];
+		//Just parses vertices and indices
+		// The file is memory mapped and split in line aligned chunks that are parsed in parallel,
+		// the face indices are only resolved (and welded into shared vertices) once every chunk is done
+		static bool ParseOBJ(const std::string& filename, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, bool flipAxisAndWinding = true)
+		{
+			const MappedFile file{ filename };
+			if (!file.IsOpen())
+				return false;
 
-						if ('/' == file.peek())//is next in buffer ==  '/' ?
-						{
-							file.ignore();//read and ignore one element ('/')
-
-							if ('/' != file.peek())
-							{
-								// Optional texture coordinate
-								file >> iTexCoord;
-								vertex.uv = UVs[iTexCoord - 1];
-							}
-
-							if ('/' == file.peek())
-							{
-								file.ignore();
-
-								// Optional vertex normal
-								file >> iNormal;
-								vertex.normal = normals[iNormal - 1];
-							}
-						}
+			vertices.clear();
+			indices.clear();
 
-						vertices.push_back(vertex);
-						tempIndices[iFace] = uint32_t(vertices.size()) - 1;
-						//indices.push_back(uint32_t(vertices.size()) - 1);
-					}
+			// A few chunks per thread balances lines of different length, small files are not worth splitting
+			const std::string_view text = file.GetView();
+			constexpr size_t minChunkSize{ 256 * 1024 };
+			const size_t threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+			const size_t chunkCount = std::clamp<size_t>(text.size() / minChunkSize, 1, threadCount * 4);
+
+			// Every chunk starts right after a line break
+			std::vector<const char*> chunkBounds(chunkCount + 1, text.data() + text.size());
+			chunkBounds[0] = text.data();
+			for (size_t chunk{ 1 }; chunk < chunkCount; ++chunk)
+			{
+				const size_t newLine = text.find('\n', std::max(text.size() * chunk / chunkCount, static_cast<size_t>(chunkBounds[chunk - 1] - text.data())));
+				chunkBounds[chunk] = newLine == std::string_view::npos ? text.data() + text.size() : text.data() + newLine + 1;
+			}
 
-					indices.push_back(tempIndices[0]);
-					if (flipAxisAndWinding) 
+			std::vector<OBJChunk> chunks(chunkCount);
+			std::vector<size_t> chunkIndices(chunkCount);
+			std::iota(chunkIndices.begin(), chunkIndices.end(), size_t{});
+			std::for_each(std::execution::par, chunkIndices.begin(), chunkIndices.end(), [&](size_t chunk)
+			{
+				ParseOBJChunk(chunkBounds[chunk], chunkBounds[chunk + 1], chunks[chunk]);
+			});
+
+			// Merge the declarations in file order, the corners of every chunk get their own range of indices
+			std::vector<Vector3> positions{};
+			std::vector<Vector3> normals{};
+			std::vector<Vector2> UVs{};
+			std::vector<size_t> cornerOffsets(chunkCount + 1);
+			for (size_t chunk{}; chunk < chunkCount; ++chunk)
+			{
+				if (chunks[chunk].malformed)
+				{
+					std::cerr << "Utils::ParseOBJ > Malformed vertex or face in " << filename << "\n";
+					return false;
+				}
+				positions.insert(positions.end(), chunks[chunk].positions.begin(), chunks[chunk].positions.end());
+				normals.insert(normals.end(), chunks[chunk].normals.begin(), chunks[chunk].normals.end());
+				UVs.insert(UVs.end(), chunks[chunk].UVs.begin(), chunks[chunk].UVs.end());
+				cornerOffsets[chunk + 1] = cornerOffsets[chunk] + chunks[chunk].corners.size();
+			}
+
+			// Corners with the same position, uv and normal share one vertex, numbered in the order they first appear.
+			// The vertex of every corner seen so far is kept in an open addressing table that stays at most half full
+			indices.resize(cornerOffsets.back());
+			const size_t tableSize = std::bit_ceil(std::max<size_t>(cornerOffsets.back() * 2, 2));
+			const int tableShift = 64 - std::countr_zero(tableSize);
+			constexpr uint32_t emptySlot{ UINT32_MAX };
+			std::vector<uint32_t> vertexTable(tableSize, emptySlot);
+			std::vector<OBJCorner> vertexCorners{};
+			for (size_t chunk{}; chunk < chunkCount; ++chunk)
+			{
+				const std::vector<OBJCorner>& corners = chunks[chunk].corners;
+				for (size_t corner{}; corner < corners.size(); ++corner)
+				{
+					// OBJ format uses 1-based arrays
+					const OBJCorner& objCorner = corners[corner];
+					if (objCorner.position < 1 or objCorner.position > static_cast<int>(positions.size())
+						or objCorner.uv < 0 or objCorner.uv > static_cast<int>(UVs.size())
+						or objCorner.normal < 0 or objCorner.normal > static_cast<int>(normals.size()))
 					{
-						indices.push_back(tempIndices[2]);
-						indices.push_back(tempIndices[1]);
+						std::cerr << "Utils::ParseOBJ > Face index out of range in " << filename << "\n";
+						vertices.clear();
+						indices.clear();
+						return false;
 					}
-					else
+
+					// Fibonacci hashing picks the first slot from the high bits, collisions probe the next ones
+					size_t slot = (HashOBJCorner(objCorner) * 0x9E3779B97F4A7C15ull) >> tableShift;
+					while (vertexTable[slot] != emptySlot and vertexCorners[vertexTable[slot]] != objCorner) slot = (slot + 1) & (tableSize - 1);
+					if (vertexTable[slot] == emptySlot)
 					{
-						indices.push_back(tempIndices[1]);
-						indices.push_back(tempIndices[2]);
+						vertexTable[slot] = static_cast<uint32_t>(vertices.size());
+						vertexCorners.push_back(objCorner);
+
+						Vertex vertex{};
+						vertex.position = positions[objCorner.position - 1];
+						if (objCorner.uv) vertex.uv = UVs[objCorner.uv - 1];
+						if (objCorner.normal) vertex.normal = normals[objCorner.normal - 1];
+						vertices.push_back(vertex);
 					}
+
+					// The second and third corner of every triangle swap places to flip the winding
+					const size_t cornerIndex = cornerOffsets[chunk] + corner;
+					const size_t cornerInTriangle = corner % 3;
+					const size_t indexPosition = flipAxisAndWinding and cornerInTriangle != 0 ? cornerIndex + 3 - 2 * cornerInTriangle : cornerIndex;
+					indices[indexPosition] = vertexTable[slot];
 				}
-				//read till end of line and ignore all remaining chars
-				file.ignore(1000, '\n');
 			}
 
 			//Cheap Tangent Calculations
@@ -216,7 +490,10 @@ namespace dae
 				const Vector3 edge1 = p2 - p0;
 				const Vector2 diffX = Vector2(uv1.x - uv0.x, uv2.x - uv0.x);
 				const Vector2 diffY = Vector2(uv1.y - uv0.y, uv2.y - uv0.y);
-				float r = 1.f / Vector2::Cross(diffX, diffY);
+				const float uvArea = Vector2::Cross(diffX, diffY);
+				// Without uv area there is no tangent direction, it would only poison the vertices the triangle shares
+				if (uvArea == 0.f) continue;
+				float r = 1.f / uvArea;
 
 				Vector3 tangent = (edge0 * diffY.y - edge1 * diffY.x) * r;
 				vertices[index0].tangent += tangent;
@@ -240,6 +517,581 @@ namespace dae
 
 			return true;
 		}
+
+		// Post-transform vertex cache of a triangle list, modelled as a FIFO of the given size like most GPUs have
+		struct VertexCacheStats
+		{
+			float acmr{};	// average cache miss ratio, transformed vertices per triangle (0.5 is the best a big mesh can get)
+			float atvr{};	// average transform to vertex ratio, 1 means every vertex is transformed exactly once
+		};
+		inline VertexCacheStats SimulateVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount, int cacheSize = VERTEX_CACHE_SIZE)
+		{
+			// The time stamp of every vertex when it entered the cache, it is still in there for cacheSize misses
+			std::vector<int64_t> vEntryTimes(vertexCount, -static_cast<int64_t>(cacheSize) - 1);
+			int64_t missCount{};
+			for (uint32_t index : indices)
+			{
+				if (missCount - vEntryTimes[index] <= cacheSize) continue;
+				vEntryTimes[index] = ++missCount;
+			}
+
+			const size_t triangleCount = indices.size() / 3;
+			return VertexCacheStats{ triangleCount ? static_cast<float>(missCount) / triangleCount : 0.f, vertexCount ? static_cast<float>(missCount) / vertexCount : 0.f };
+		}
+
+		// Reorders the triangles of a triangle list for the post-transform vertex cache (Tipsify, Sander et al. 2007),
+		// then the vertices in the order the triangles first use them so fetching them walks through memory
+		inline void OptimizeVertexCache(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, int cacheSize = VERTEX_CACHE_SIZE)
+		{
+			const size_t vertexCount = vertices.size();
+			const size_t triangleCount = indices.size() / 3;
+			if (triangleCount == 0) return;
+
+			// The triangles around every vertex, vTriangleOffsets[v] to vTriangleOffsets[v + 1] in vAdjacentTriangles
+			std::vector<uint32_t> vTriangleOffsets(vertexCount + 1);
+			for (uint32_t index : indices) ++vTriangleOffsets[index + 1];
+			std::partial_sum(vTriangleOffsets.begin(), vTriangleOffsets.end(), vTriangleOffsets.begin());
+			std::vector<uint32_t> vAdjacentTriangles(indices.size());
+			{
+				std::vector<uint32_t> vFill(vTriangleOffsets.begin(), vTriangleOffsets.end() - 1);
+				for (size_t corner{}; corner < triangleCount * 3; ++corner)
+					vAdjacentTriangles[vFill[indices[corner]]++] = static_cast<uint32_t>(corner / 3);
+			}
+
+			// Triangles still to emit around every vertex, and when the vertex last entered the cache
+			std::vector<uint32_t> vLiveTriangles(vertexCount);
+			for (size_t vertex{}; vertex < vertexCount; ++vertex) vLiveTriangles[vertex] = vTriangleOffsets[vertex + 1] - vTriangleOffsets[vertex];
+			std::vector<int64_t> vCacheTimes(vertexCount, 0);
+			std::vector<uint8_t> vEmitted(triangleCount, 0);
+			// Vertices of the last emitted triangles, to continue from when the current fan runs out
+			std::vector<uint32_t> vDeadEnds{};
+			std::vector<uint32_t> vCandidates{};
+			std::vector<uint32_t> vOptimizedIndices{};
+			vOptimizedIndices.reserve(triangleCount * 3);
+
+			int64_t time{ cacheSize + 1 };
+			size_t scanVertex{ 1 };
+			int64_t fanVertex{ 0 };
+			while (fanVertex >= 0)
+			{
+				// Emit every triangle left around the fanning vertex
+				vCandidates.clear();
+				for (uint32_t adjacent{ vTriangleOffsets[fanVertex] }; adjacent < vTriangleOffsets[fanVertex + 1]; ++adjacent)
+				{
+					const uint32_t triangle = vAdjacentTriangles[adjacent];
+					if (vEmitted[triangle]) continue;
+					vEmitted[triangle] = 1;
+
+					for (size_t corner{}; corner < 3; ++corner)
+					{
+						const uint32_t vertex = indices[triangle * 3 + corner];
+						vOptimizedIndices.push_back(vertex);
+						vDeadEnds.push_back(vertex);
+						vCandidates.push_back(vertex);
+						--vLiveTriangles[vertex];
+						if (time - vCacheTimes[vertex] > cacheSize) vCacheTimes[vertex] = time++;
+					}
+				}
+
+				// Continue with the candidate that is oldest in the cache but will still be in it after emitting its triangles
+				fanVertex = -1;
+				int64_t bestPriority{ -1 };
+				for (uint32_t candidate : vCandidates)
+				{
+					if (vLiveTriangles[candidate] == 0) continue;
+					int64_t priority{ 0 };
+					if (time - vCacheTimes[candidate] + 2 * static_cast<int64_t>(vLiveTriangles[candidate]) <= cacheSize) priority = time - vCacheTimes[candidate];
+					if (priority > bestPriority)
+					{
+						bestPriority = priority;
+						fanVertex = candidate;
+					}
+				}
+				if (fanVertex >= 0) continue;
+
+				// Dead end, go back to a recent vertex that still has triangles, or else the next one in input order
+				while (!vDeadEnds.empty() and fanVertex < 0)
+				{
+					const uint32_t vertex = vDeadEnds.back();
+					vDeadEnds.pop_back();
+					if (vLiveTriangles[vertex] > 0) fanVertex = vertex;
+				}
+				while (fanVertex < 0 and scanVertex < vertexCount)
+				{
+					if (vLiveTriangles[scanVertex] > 0) fanVertex = static_cast<int64_t>(scanVertex);
+					++scanVertex;
+				}
+			}
+			indices.swap(vOptimizedIndices);
+
+			// Number the vertices in order of first use, unused ones keep their relative order at the end
+			constexpr uint32_t unassigned{ UINT32_MAX };
+			std::vector<uint32_t> vRemap(vertexCount, unassigned);
+			uint32_t nextVertex{};
+			for (uint32_t& index : indices)
+			{
+				if (vRemap[index] == unassigned) vRemap[index] = nextVertex++;
+				index = vRemap[index];
+			}
+			for (uint32_t& newIndex : vRemap) if (newIndex == unassigned) newIndex = nextVertex++;
+
+			std::vector<Vertex> vReordered(vertexCount);
+			for (size_t vertex{}; vertex < vertexCount; ++vertex) vReordered[vRemap[vertex]] = vertices[vertex];
+			vertices.swap(vReordered);
+		}
+
+		// Weighted sum of squared distances to a set of planes, as a symmetric 4x4 matrix (Garland and Heckbert 1997)
+		struct Quadric
+		{
+			double xx{}, xy{}, xz{}, xw{}, yy{}, yz{}, yw{}, zz{}, zw{}, ww{};
+			double weight{};
+
+			static Quadric FromPlane(const Vector3& normal, float distance, float weight)
+			{
+				const double x{ normal.x }, y{ normal.y }, z{ normal.z }, w{ distance }, s{ weight };
+				return Quadric{ x * x * s, x * y * s, x * z * s, x * w * s, y * y * s, y * z * s, y * w * s, z * z * s, z * w * s, w * w * s, s };
+			}
+			Quadric& operator+=(const Quadric& other)
+			{
+				xx += other.xx; xy += other.xy; xz += other.xz; xw += other.xw; yy += other.yy;
+				yz += other.yz; yw += other.yw; zz += other.zz; zw += other.zw; ww += other.ww;
+				weight += other.weight;
+				return *this;
+			}
+			// Mean squared distance of the point to the planes
+			double Evaluate(const Vector3& point) const
+			{
+				if (weight <= 0.0) return 0.0;
+				const double x{ point.x }, y{ point.y }, z{ point.z };
+				const double error = x * x * xx + y * y * yy + z * z * zz + 2.0 * (x * y * xy + x * z * xz + y * z * yz + x * xw + y * yw + z * zw) + ww;
+				return std::max(error / weight, 0.0);
+			}
+		};
+
+		// Simplifies a triangle list by collapsing edges in order of their quadric error until at most targetTriangleCount
+		// triangles are left, or the next collapse would move the surface further than maxError (root mean square distance
+		// to the planes of the original triangles around the point).
+		// Vertices only ever collapse onto other vertices, so the result indexes the same vertices. Where vertices share a position
+		// (uv and normal seams) the whole position collapses at once, every vertex onto the one on its side of the seam.
+		// Open borders are kept as they are. sourceTriangles gets the input triangle every output triangle is what is left of
+		inline std::vector<uint32_t> SimplifyMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, size_t targetTriangleCount,
+			float maxError, float& error, std::vector<uint32_t>& sourceTriangles)
+		{
+			const size_t vertexCount = vertices.size();
+			const size_t triangleCount = indices.size() / 3;
+			error = 0.f;
+			sourceTriangles.clear();
+
+			// Collapses work on positions ("points"), the vertices split along seams all belong to the same one
+			std::vector<uint32_t> vPoints(vertexCount);
+			std::vector<Vector3> vPointPositions{};
+			{
+				std::vector<uint32_t> vSorted(vertexCount);
+				std::iota(vSorted.begin(), vSorted.end(), 0u);
+				const auto less = [&vertices](uint32_t a, uint32_t b)
+				{
+					const Vector3& pa = vertices[a].position;
+					const Vector3& pb = vertices[b].position;
+					return std::tie(pa.x, pa.y, pa.z) < std::tie(pb.x, pb.y, pb.z);
+				};
+				std::sort(vSorted.begin(), vSorted.end(), less);
+				for (size_t sorted{}; sorted < vertexCount; ++sorted)
+				{
+					if (sorted == 0 or less(vSorted[sorted - 1], vSorted[sorted])) vPointPositions.push_back(vertices[vSorted[sorted]].position);
+					vPoints[vSorted[sorted]] = static_cast<uint32_t>(vPointPositions.size() - 1);
+				}
+			}
+			const size_t pointCount = vPointPositions.size();
+
+			// Points on an open or non-manifold edge (not exactly two triangles) are locked
+			std::vector<uint8_t> vLocked(pointCount, 0);
+			{
+				std::vector<uint64_t> vEdges{};
+				vEdges.reserve(triangleCount * 3);
+				for (size_t triangle{}; triangle < triangleCount; ++triangle)
+				{
+					for (size_t corner{}; corner < 3; ++corner)
+					{
+						const uint64_t a = vPoints[indices[triangle * 3 + corner]];
+						const uint64_t b = vPoints[indices[triangle * 3 + (corner + 1) % 3]];
+						if (a != b) vEdges.push_back(std::min(a, b) << 32 | std::max(a, b));
+					}
+				}
+				std::sort(vEdges.begin(), vEdges.end());
+				for (size_t first{}; first < vEdges.size();)
+				{
+					size_t last{ first + 1 };
+					while (last < vEdges.size() and vEdges[last] == vEdges[first]) ++last;
+					if (last - first != 2)
+					{
+						vLocked[vEdges[first] >> 32] = 1;
+						vLocked[vEdges[first] & UINT32_MAX] = 1;
+					}
+					first = last;
+				}
+			}
+
+			// Every point starts with the planes of the triangles around it, weighted by their area
+			std::vector<uint32_t> vCorners(indices.begin(), indices.begin() + triangleCount * 3);
+			std::vector<uint8_t> vAlive(triangleCount, 1);
+			std::vector<Quadric> vQuadrics(pointCount);
+			std::vector<std::vector<uint32_t>> vPointTriangles(pointCount);
+			size_t aliveCount{ triangleCount };
+			const auto getPosition = [&](uint32_t vertex) -> const Vector3& { return vPointPositions[vPoints[vertex]]; };
+			for (uint32_t triangle{}; triangle < triangleCount; ++triangle)
+			{
+				const Vector3& p0 = getPosition(vCorners[triangle * 3 + 0]);
+				const Vector3 normal = Vector3::Cross(getPosition(vCorners[triangle * 3 + 1]) - p0, getPosition(vCorners[triangle * 3 + 2]) - p0);
+				const float length = normal.Magnitude();
+				const Quadric plane = length > 0.f ? Quadric::FromPlane(normal / length, -Vector3::Dot(normal / length, p0), length * 0.5f) : Quadric{};
+				for (size_t corner{}; corner < 3; ++corner)
+				{
+					const uint32_t point = vPoints[vCorners[triangle * 3 + corner]];
+					vQuadrics[point] += plane;
+					vPointTriangles[point].push_back(triangle);
+				}
+			}
+
+			// Candidate collapses, cheapest first. A candidate is stale once either point collapsed or took another point in
+			struct Collapse
+			{
+				double cost;
+				uint32_t from, to;
+				uint32_t fromVersion, toVersion;
+				bool operator<(const Collapse& other) const { return cost > other.cost; }
+			};
+			std::priority_queue<Collapse> collapses{};
+			std::vector<uint32_t> vVersions(pointCount, 0);
+			std::vector<uint8_t> vRemoved(pointCount, 0);
+			const auto pushEdge = [&](uint32_t a, uint32_t b)
+			{
+				Quadric quadric = vQuadrics[a];
+				quadric += vQuadrics[b];
+				if (!vLocked[a]) collapses.push({ quadric.Evaluate(vPointPositions[b]), a, b, vVersions[a], vVersions[b] });
+				if (!vLocked[b]) collapses.push({ quadric.Evaluate(vPointPositions[a]), b, a, vVersions[b], vVersions[a] });
+			};
+			for (size_t triangle{}; triangle < triangleCount; ++triangle)
+			{
+				for (size_t corner{}; corner < 3; ++corner)
+				{
+					const uint32_t a = vPoints[vCorners[triangle * 3 + corner]];
+					const uint32_t b = vPoints[vCorners[triangle * 3 + (corner + 1) % 3]];
+					if (a < b) pushEdge(a, b);
+				}
+			}
+
+			const double maxCost = static_cast<double>(maxError) * maxError;
+			double largestCost{};
+			std::vector<std::pair<uint32_t, uint32_t>> vRemap{};
+			while (aliveCount > targetTriangleCount and !collapses.empty())
+			{
+				const Collapse collapse = collapses.top();
+				collapses.pop();
+				if (vRemoved[collapse.from] or vRemoved[collapse.to] or vVersions[collapse.from] != collapse.fromVersion or vVersions[collapse.to] != collapse.toVersion) continue;
+				if (collapse.cost > maxCost) break;
+
+				// Every vertex at the point moves to the vertex it shares an edge with at the other point
+				vRemap.clear();
+				for (uint32_t triangle : vPointTriangles[collapse.from])
+				{
+					if (!vAlive[triangle]) continue;
+					uint32_t fromVertex{ UINT32_MAX };
+					uint32_t toVertex{ UINT32_MAX };
+					for (size_t corner{}; corner < 3; ++corner)
+					{
+						const uint32_t vertex = vCorners[triangle * 3 + corner];
+						if (vPoints[vertex] == collapse.from) fromVertex = vertex;
+						else if (vPoints[vertex] == collapse.to) toVertex = vertex;
+					}
+					if (std::none_of(vRemap.begin(), vRemap.end(), [fromVertex](const auto& remap) { return remap.first == fromVertex; }))
+						vRemap.emplace_back(fromVertex, toVertex);
+					else if (toVertex != UINT32_MAX)
+						for (auto& remap : vRemap) if (remap.first == fromVertex and remap.second == UINT32_MAX) remap.second = toVertex;
+				}
+				// A vertex without one is on the other side of a seam the edge does not run along
+				if (vRemap.empty() or std::any_of(vRemap.begin(), vRemap.end(), [](const auto& remap) { return remap.second == UINT32_MAX; })) continue;
+
+				// The triangles that stay may not turn over
+				bool flips{ false };
+				for (uint32_t triangle : vPointTriangles[collapse.from])
+				{
+					if (!vAlive[triangle]) continue;
+					Vector3 positions[3]{};
+					Vector3 moved[3]{};
+					bool degenerates{ false };
+					for (size_t corner{}; corner < 3; ++corner)
+					{
+						const uint32_t point = vPoints[vCorners[triangle * 3 + corner]];
+						degenerates = degenerates or point == collapse.to;
+						positions[corner] = vPointPositions[point];
+						moved[corner] = point == collapse.from ? vPointPositions[collapse.to] : positions[corner];
+					}
+					if (degenerates) continue;
+					const Vector3 before = Vector3::Cross(positions[1] - positions[0], positions[2] - positions[0]);
+					const Vector3 after = Vector3::Cross(moved[1] - moved[0], moved[2] - moved[0]);
+					if (Vector3::Dot(before, after) <= 0.f)
+					{
+						flips = true;
+						break;
+					}
+				}
+				if (flips) continue;
+
+				// Triangles along the edge disappear, the others move over to the remaining point
+				for (uint32_t triangle : vPointTriangles[collapse.from])
+				{
+					if (!vAlive[triangle]) continue;
+					bool degenerates{ false };
+					for (size_t corner{}; corner < 3; ++corner)
+					{
+						uint32_t& vertex = vCorners[triangle * 3 + corner];
+						if (vPoints[vertex] == collapse.to) degenerates = true;
+						for (const auto& remap : vRemap) if (remap.first == vertex) vertex = remap.second;
+					}
+					if (degenerates)
+					{
+						vAlive[triangle] = 0;
+						--aliveCount;
+					}
+					else vPointTriangles[collapse.to].push_back(triangle);
+				}
+				std::vector<uint32_t>{}.swap(vPointTriangles[collapse.from]);
+				vRemoved[collapse.from] = 1;
+				vQuadrics[collapse.to] += vQuadrics[collapse.from];
+				++vVersions[collapse.to];
+				largestCost = std::max(largestCost, collapse.cost);
+
+				// The remaining point has a new quadric, so new costs for all its edges
+				std::vector<uint32_t>& vTriangles = vPointTriangles[collapse.to];
+				vTriangles.erase(std::remove_if(vTriangles.begin(), vTriangles.end(), [&vAlive](uint32_t triangle) { return !vAlive[triangle]; }), vTriangles.end());
+				for (uint32_t triangle : vTriangles)
+				{
+					for (size_t corner{}; corner < 3; ++corner)
+					{
+						const uint32_t point = vPoints[vCorners[triangle * 3 + corner]];
+						if (point != collapse.to) pushEdge(collapse.to, point);
+					}
+				}
+			}
+
+			std::vector<uint32_t> vSimplified{};
+			vSimplified.reserve(aliveCount * 3);
+			sourceTriangles.reserve(aliveCount);
+			for (uint32_t triangle{}; triangle < triangleCount; ++triangle)
+			{
+				if (!vAlive[triangle]) continue;
+				vSimplified.insert(vSimplified.end(), vCorners.begin() + triangle * 3, vCorners.begin() + triangle * 3 + 3);
+				sourceTriangles.push_back(triangle);
+			}
+			error = static_cast<float>(std::sqrt(largestCost));
+			return vSimplified;
+		}
+
+		inline MeshBounds CalculateMeshBounds(const std::vector<Vertex>& vertices)
+		{
+			MeshBounds bounds{};
+			if (vertices.empty()) return bounds;
+
+			bounds.min = bounds.max = vertices.front().position;
+			for (const Vertex& vertex : vertices)
+			{
+				bounds.min = Vector3::Min(bounds.min, vertex.position);
+				bounds.max = Vector3::Max(bounds.max, vertex.position);
+			}
+			const Vector3 center = (bounds.min + bounds.max) * 0.5f;
+			for (const Vertex& vertex : vertices)
+				bounds.radius = std::max(bounds.radius, (vertex.position - center).Magnitude());
+			return bounds;
+		}
+
+		// LOD chain of a triangle list, from finest to coarsest, see MESH_LOD_COUNT
+		inline std::vector<MeshLOD> BuildMeshLODs(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, const MeshBounds& bounds)
+		{
+			std::vector<MeshLOD> vLODs{};
+			if (vertices.empty()) return vLODs;
+
+			const float maxError = (bounds.max - bounds.min).Magnitude() * 0.5f * MESH_LOD_MAX_ERROR;
+
+			size_t triangleCount = indices.size() / 3;
+			for (int level{}; level < MESH_LOD_COUNT; ++level)
+			{
+				// Every level starts over from the full detail mesh, so its error is measured against that
+				const size_t targetCount = static_cast<size_t>(static_cast<float>(triangleCount) * MESH_LOD_TRIANGLE_RATIO);
+				MeshLOD lod{};
+				lod.indices = SimplifyMesh(vertices, indices, targetCount, maxError, lod.error, lod.sourceTriangles);
+				// Not worth a level of its own when the simplifier got stuck well short of the target
+				if (lod.sourceTriangles.size() * 2 > triangleCount + targetCount) break;
+				triangleCount = lod.sourceTriangles.size();
+				vLODs.push_back(std::move(lod));
+			}
+			return vLODs;
+		}
+
+		// Binary mesh cache, written next to the OBJ after it is parsed and optimized once: a header with the bounds followed by the
+		// vertex and index blobs in their in-memory layout, so loading it is a page-in and a copy instead of parsing.
+		// The LODs follow as a table of MeshCacheLOD, then the indices and source triangles of every LOD in turn
+		struct MeshCacheHeader
+		{
+			char magic[4]{ 'M', 'E', 'S', 'H' };
+			uint32_t version{ MESH_CACHE_VERSION };
+			uint32_t vertexSize{ sizeof(Vertex) };
+			uint32_t vertexCount{};
+			uint32_t indexCount{};
+			uint32_t padding{};
+			// The cache is stale as soon as the OBJ it was made from changes size or is written to
+			uint64_t sourceSize{};
+			int64_t sourceWriteTime{};
+			Vector3 boundsMin{};
+			Vector3 boundsMax{};
+			float boundsRadius{};
+			uint32_t boundsPadding{};
+			uint64_t vertexOffset{};
+			uint64_t indexOffset{};
+			uint32_t lodCount{};
+			uint32_t lodPadding{};
+			uint64_t lodOffset{};
+		};
+		struct MeshCacheLOD
+		{
+			uint32_t indexCount{};
+			float error{};
+		};
+		inline std::string GetMeshCachePath(const std::string& objPath)
+		{
+			return objPath + ".meshcache";
+		}
+		// Size and last write time of the OBJ, false if there is no such file
+		inline bool GetMeshSourceStamp(const std::string& objPath, uint64_t& size, int64_t& writeTime)
+		{
+			std::error_code error{};
+			size = std::filesystem::file_size(objPath, error);
+			if (error) return false;
+			writeTime = static_cast<int64_t>(std::filesystem::last_write_time(objPath, error).time_since_epoch().count());
+			return !error;
+		}
+
+		// False when there is no cache, it does not match the OBJ anymore or its contents are not a valid mesh.
+		// Nothing is written to the outputs then
+		inline bool LoadMeshCache(const std::string& objPath, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, std::vector<MeshLOD>& lods, MeshBounds& bounds)
+		{
+			uint64_t sourceSize{};
+			int64_t sourceWriteTime{};
+			if (!GetMeshSourceStamp(objPath, sourceSize, sourceWriteTime)) return false;
+
+			const MappedFile file{ GetMeshCachePath(objPath) };
+			const std::string_view data = file.GetView();
+			if (data.size() < sizeof(MeshCacheHeader)) return false;
+
+			MeshCacheHeader header{};
+			std::memcpy(&header, data.data(), sizeof(MeshCacheHeader));
+			const MeshCacheHeader expected{};
+			if (std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 or header.version != expected.version
+				or header.vertexSize != expected.vertexSize or header.sourceSize != sourceSize or header.sourceWriteTime != sourceWriteTime
+				or !(header.boundsRadius >= 0.f))
+				return false;
+			// A cache that was cut off is as good as none
+			const auto fits = [&data](uint64_t offset, uint64_t size) { return offset <= data.size() and size <= data.size() - offset; };
+			if (!fits(header.vertexOffset, static_cast<uint64_t>(header.vertexCount) * sizeof(Vertex))
+				or !fits(header.indexOffset, static_cast<uint64_t>(header.indexCount) * sizeof(uint32_t))
+				or !fits(header.lodOffset, static_cast<uint64_t>(header.lodCount) * sizeof(MeshCacheLOD)))
+				return false;
+
+			// Every index has to name a vertex and every source triangle a full detail triangle, or the renderer reads out of bounds
+			const auto validIndices = [&header](const std::vector<uint32_t>& vIndices)
+			{
+				return vIndices.size() % 3 == 0 and std::all_of(vIndices.begin(), vIndices.end(), [&header](uint32_t index) { return index < header.vertexCount; });
+			};
+			std::vector<Vertex> vVertices(header.vertexCount);
+			std::vector<uint32_t> vIndices(header.indexCount);
+			std::memcpy(vVertices.data(), data.data() + header.vertexOffset, vVertices.size() * sizeof(Vertex));
+			std::memcpy(vIndices.data(), data.data() + header.indexOffset, vIndices.size() * sizeof(uint32_t));
+			if (!validIndices(vIndices)) return false;
+
+			std::vector<MeshCacheLOD> vCacheLODs(header.lodCount);
+			std::memcpy(vCacheLODs.data(), data.data() + header.lodOffset, vCacheLODs.size() * sizeof(MeshCacheLOD));
+			std::vector<MeshLOD> vLODs(vCacheLODs.size());
+			uint64_t lodDataOffset = header.lodOffset + vCacheLODs.size() * sizeof(MeshCacheLOD);
+			for (size_t level{}; level < vLODs.size(); ++level)
+			{
+				MeshLOD& lod = vLODs[level];
+				const MeshCacheLOD& cacheLOD = vCacheLODs[level];
+				const uint64_t indicesSize = static_cast<uint64_t>(cacheLOD.indexCount) * sizeof(uint32_t);
+				const uint64_t sourceTrianglesSize = static_cast<uint64_t>(cacheLOD.indexCount / 3) * sizeof(uint32_t);
+				if (!(cacheLOD.error >= 0.f) or !fits(lodDataOffset, indicesSize + sourceTrianglesSize)) return false;
+
+				lod.error = cacheLOD.error;
+				lod.indices.resize(cacheLOD.indexCount);
+				lod.sourceTriangles.resize(cacheLOD.indexCount / 3);
+				std::memcpy(lod.indices.data(), data.data() + lodDataOffset, indicesSize);
+				std::memcpy(lod.sourceTriangles.data(), data.data() + lodDataOffset + indicesSize, sourceTrianglesSize);
+				lodDataOffset += indicesSize + sourceTrianglesSize;
+				const uint32_t triangleCount = header.indexCount / 3;
+				if (!validIndices(lod.indices)
+					or !std::all_of(lod.sourceTriangles.begin(), lod.sourceTriangles.end(), [triangleCount](uint32_t triangle) { return triangle < triangleCount; }))
+					return false;
+			}
+
+			vertices.swap(vVertices);
+			indices.swap(vIndices);
+			lods.swap(vLODs);
+			bounds = MeshBounds{ header.boundsMin, header.boundsMax, header.boundsRadius };
+			return true;
+		}
+		// Best effort, without a cache the OBJ is just parsed again next time
+		inline void WriteMeshCache(const std::string& objPath, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, const std::vector<MeshLOD>& lods,
+			const MeshBounds& bounds)
+		{
+			MeshCacheHeader header{};
+			if (vertices.empty() or !GetMeshSourceStamp(objPath, header.sourceSize, header.sourceWriteTime)) return;
+
+			header.vertexCount = static_cast<uint32_t>(vertices.size());
+			header.indexCount = static_cast<uint32_t>(indices.size());
+			header.boundsMin = bounds.min;
+			header.boundsMax = bounds.max;
+			header.boundsRadius = bounds.radius;
+			// The vertex and index blobs start 16 byte aligned. The loader copies them into vectors, it does not use them in place
+			constexpr uint64_t blobAlignment{ 16 };
+			const auto align = [](uint64_t offset) { return (offset + blobAlignment - 1) / blobAlignment * blobAlignment; };
+			header.vertexOffset = align(sizeof(MeshCacheHeader));
+			header.indexOffset = align(header.vertexOffset + vertices.size() * sizeof(Vertex));
+			header.lodCount = static_cast<uint32_t>(lods.size());
+			header.lodOffset = align(header.indexOffset + indices.size() * sizeof(uint32_t));
+
+			// Written under another name first, a crash halfway or another instance reading it never sees half a cache
+			const std::string cachePath = GetMeshCachePath(objPath);
+			const std::string temporaryPath = cachePath + ".tmp";
+			{
+				std::ofstream file{ temporaryPath, std::ios::binary | std::ios::trunc };
+				if (!file) return;
+				const char zeros[blobAlignment]{};
+				file.write(reinterpret_cast<const char*>(&header), sizeof(MeshCacheHeader));
+				file.write(zeros, header.vertexOffset - sizeof(MeshCacheHeader));
+				file.write(reinterpret_cast<const char*>(vertices.data()), vertices.size() * sizeof(Vertex));
+				file.write(zeros, header.indexOffset - header.vertexOffset - vertices.size() * sizeof(Vertex));
+				file.write(reinterpret_cast<const char*>(indices.data()), indices.size() * sizeof(uint32_t));
+				file.write(zeros, header.lodOffset - header.indexOffset - indices.size() * sizeof(uint32_t));
+				for (const MeshLOD& lod : lods)
+				{
+					const MeshCacheLOD cacheLOD{ static_cast<uint32_t>(lod.indices.size()), lod.error };
+					file.write(reinterpret_cast<const char*>(&cacheLOD), sizeof(MeshCacheLOD));
+				}
+				for (const MeshLOD& lod : lods)
+				{
+					file.write(reinterpret_cast<const char*>(lod.indices.data()), lod.indices.size() * sizeof(uint32_t));
+					file.write(reinterpret_cast<const char*>(lod.sourceTriangles.data()), lod.sourceTriangles.size() * sizeof(uint32_t));
+				}
+				if (!file)
+				{
+					file.close();
+					std::error_code error{};
+					std::filesystem::remove(temporaryPath, error);
+					return;
+				}
+			}
+			std::error_code error{};
+			std::filesystem::rename(temporaryPath, cachePath, error);
+			if (error) std::filesystem::remove(temporaryPath, error);
+		}
 #pragma warning(pop)
 	}
 }
\ No newline at end of file
@@ -23,6 +23,7 @@ void PrintInfo()
 	std::cout << "   [F1]  Toggle Rasterizer Mode (HARDWARE/SOFTWARE)\n";
 	std::cout << "   [F2]  Toggle Vehicle Rotation (ON/OFF)\n";
 	std::cout << "   [F3]  Toggle FireFX (ON/OFF)\n";
+	std::cout << "   [F4]  Cycle Sampler State (POINT/LINEAR/ANISOTROPIC)\n";
 	std::cout << "   [F9]  Cycle CullMode (BACK/FRONT/NONE)\n";
 	std::cout << "   [F10] Toggle Uniform ClearColor (ON/OFF)\n";
 	std::cout << "   [F11] Toggle Print FPS (ON/OFF)\n";
@@ -30,7 +31,6 @@ void PrintInfo()
 
 	std::cout << DARK_GREEN_TXT;
 	std::cout << "[Key Bindings - HARDWARE]\n";
-	std::cout << "   [F4] Cycle Sampler State (POINT/LINEAR/ANISOTROPIC)\n";
 	std::cout << "   [ENTER] Toggle Shadows (ON/OFF)\n";
 	std::cout << "\n";
 
@@ -41,6 +41,11 @@ void PrintInfo()
 	std::cout << "   [F7] Toggle DepthBuffer Visualization (ON/OFF)\n";
 	std::cout << "   [F8] Toggle BoundingBox Visualization (ON/OFF)\n";
 	std::cout << "   [TAB] Toggle Wireframe Visualization (ON/OFF)\n";
+	std::cout << "   [M] Toggle Tiled Multithreaded Rasterization (ON/OFF)\n";
+	std::cout << "   [V] Toggle SIMD (AVX2) Rasterization (ON/OFF)\n";
+	std::cout << "   [B] Toggle Deferred (Visibility Buffer) Shading (ON/OFF)\n";
+	std::cout << "   [T] Toggle Tiled Texture Layout (TILED/LINEAR)\n";
+	std::cout << "   [L] Toggle Mesh LODs (ON/OFF)\n";
 	std::cout << "\n";
 
 	std::cout << BRIGHT_BLUE_TXT;
@@ -103,6 +108,16 @@ int main(int argc, char* args[])
 					pRenderer->ToggleWireFrames();
 				if (e.key.keysym.scancode == SDL_SCANCODE_RETURN)	// DONE
 					pRenderer->ToggleShadows();
+				if (e.key.keysym.scancode == SDL_SCANCODE_M)
+					pRenderer->ToggleTiledRasterization();
+				if (e.key.keysym.scancode == SDL_SCANCODE_V)
+					pRenderer->ToggleSIMDRasterization();
+				if (e.key.keysym.scancode == SDL_SCANCODE_B)
+					pRenderer->ToggleDeferredShading();
+				if (e.key.keysym.scancode == SDL_SCANCODE_T)
+					pRenderer->ToggleTextureLayout();
+				if (e.key.keysym.scancode == SDL_SCANCODE_L)
+					pRenderer->ToggleLOD();
 				if (e.key.keysym.scancode == SDL_SCANCODE_F1)		// DONE
 					pRenderer->ToggleRenderer();
 				if (e.key.keysym.scancode == SDL_SCANCODE_F2)		// DONE
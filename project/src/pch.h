@@ -7,17 +7,36 @@
 #include <memory>
 #define NOMINMAX  //for directx
 
+// Only the software rasterizer kernels are compiled for AVX2 (AVX2_TARGET), the rest of the build runs on any x64 CPU.
+// The renderer only runs them when the CPU supports AVX2 (SDL_HasAVX2)
+#if defined(SOFTWARE_RASTERIZER_AVX2) && (defined(__x86_64__) || defined(_M_X64))
+#define AVX2_KERNELS 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#define AVX2_TARGET
+#else
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
 // SDL Headers
 #include "SDL.h"
+#if !defined(SOFTWARE_ONLY)
 #include "SDL_syswm.h"
+#endif
 #include "SDL_surface.h"
 #include "SDL_image.h"
 
+#if defined(SOFTWARE_ONLY)
+// Null GPU Backend (headless software rasterizer build)
+#include "NullGPU.h"
+#else
 // DirectX Headers
 #include <dxgi.h>
 #include <d3d11.h>
 #include <d3dcompiler.h>
 #include <d3dx11effect.h>
+#endif
 
 // Framework Headers
 #include "Timer.h"